@@ -0,0 +1,75 @@
+"""Builds the asset pack read by the game (modules/AssetPack.hpp).
+
+Usage: python AssetPacker.py [game folder] [pack file]
+By default it packs CG_PRJ/models, textures, shaders (the .spv only), audio and config into CG_PRJ/assets.pack.
+The paths are stored relative to the game folder, with forward slashes, as the game asks for them.
+"""
+import os
+import struct
+import sys
+
+MAGIC = b"MGPK"
+VERSION = 1
+ALIGNMENT = 64
+FOLDERS = ["models", "textures", "shaders", "audio", "config"]
+
+HEADER = struct.Struct("<4sIIIQQ")  # AssetPackHeader
+ENTRY = struct.Struct("<QQII")      # AssetPackEntry
+
+
+def align(offset):
+    return (offset + ALIGNMENT - 1) // ALIGNMENT * ALIGNMENT
+
+
+def collect(root):
+    files = []
+    for folder in FOLDERS:
+        for directory, _, names in os.walk(os.path.join(root, folder)):
+            for name in names:
+                # The game loads the compiled shaders, not their sources
+                if folder == "shaders" and not name.endswith(".spv"):
+                    continue
+                path = os.path.join(directory, name)
+                files.append((os.path.relpath(path, root).replace(os.sep, "/"), path))
+    # Sorted by the bytes of the path, the order of the binary search in AssetPack::find
+    files.sort(key=lambda f: f[0].encode("utf-8"))
+    return files
+
+
+def pack(root, output):
+    files = collect(root)
+    names = b""
+    name_ranges = []
+    for name, _ in files:
+        encoded = name.encode("utf-8")
+        name_ranges.append((len(names), len(encoded)))
+        names += encoded
+
+    index_offset = HEADER.size
+    names_offset = index_offset + ENTRY.size * len(files)
+    offset = align(names_offset + len(names))
+
+    entries = []
+    for (name, path), (name_offset, name_size) in zip(files, name_ranges):
+        size = os.path.getsize(path)
+        entries.append((offset, size, name_offset, name_size))
+        offset = align(offset + size)
+
+    with open(output, "wb") as out:
+        out.write(HEADER.pack(MAGIC, VERSION, len(files), ALIGNMENT, index_offset, names_offset))
+        for entry in entries:
+            out.write(ENTRY.pack(*entry))
+        out.write(names)
+        for (name, path), entry in zip(files, entries):
+            out.write(b"\0" * (entry[0] - out.tell()))
+            with open(path, "rb") as f:
+                out.write(f.read())
+
+    print(f"Packed {len(files)} files into {output} ({os.path.getsize(output) // 1024} KB)")
+
+
+if __name__ == "__main__":
+    here = os.path.dirname(os.path.abspath(__file__))
+    root = sys.argv[1] if len(sys.argv) > 1 else os.path.join(here, "CG_PRJ")
+    output = sys.argv[2] if len(sys.argv) > 2 else os.path.join(root, "assets.pack")
+    pack(root, output)
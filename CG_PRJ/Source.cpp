@@ -1,14 +1,15 @@
 #include "modules/Starter.hpp"
+#include "modules/RaceSim.hpp"
+#include "modules/InstanceMatrices.hpp"
+#include "modules/Frustum.hpp"
 #include <filesystem>
 #include <map>
 #include <string>
 #include <random>
 #include <audio.hpp>
 
-#define MAP_SIZE 11
-#define DIRECTIONS 4
-#define SCALING_FACTOR 16.0f
-#define NUM_CARS 3
+// Cars whose head and rear lights are applied to the road, must match RoadShader.frag
+#define MAX_LIT_CARS 3
 
 //Global
 struct GlobalUniformBufferObject {
@@ -16,65 +17,49 @@ struct GlobalUniformBufferObject {
 	alignas(16) glm::vec3 lightPos;
 	alignas(16) glm::vec4 lightColor;
 	alignas(16) glm::vec3 viewerPosition;
-};
-
-//Car
-struct CarUniformBufferObject {
-	alignas(16) glm::mat4 mvpMat; //World View Projection Matrix
-	alignas(16) glm::mat4 mMat;   //Model/World Matrix
-	alignas(16) glm::mat4 nMat;   //Normal Matrix
+	alignas(16) glm::mat4 vpMat;  //View Projection Matrix, applied in the shaders to the static instances
+	//Road Lamps
+	alignas(16) glm::vec4 lightColorSpot;
 };
 
 struct CarLightsUniformBufferObject {
 	// Headlights
-	alignas(16) glm::vec3 headlightPosition[NUM_CARS][2];  //left and right
-	alignas(16) glm::vec3 headlightDirection[NUM_CARS][2];
-	alignas(16) glm::vec4 headlightColor[NUM_CARS][2];
+	alignas(16) glm::vec3 headlightPosition[MAX_LIT_CARS][2];  //left and right
+	alignas(16) glm::vec3 headlightDirection[MAX_LIT_CARS][2];
+	alignas(16) glm::vec4 headlightColor[MAX_LIT_CARS][2];
 
 	//Rear lights
-	alignas(16) glm::vec3 rearLightPosition[NUM_CARS][2];  //left and right
-	alignas(16) glm::vec3 rearLightDirection[NUM_CARS][2];
-	alignas(16) glm::vec4 rearLightColor[NUM_CARS][2];
-};
-
-//Road
-struct RoadUniformBufferObject {
-	alignas(16) glm::mat4 mvpMat[MAP_SIZE * MAP_SIZE];
-	alignas(16) glm::mat4 mMat[MAP_SIZE * MAP_SIZE];
-	alignas(16) glm::mat4 nMat[MAP_SIZE * MAP_SIZE];
-};
-
-struct RoadLightsUniformBufferObject {
-	alignas(16) glm::vec4 spotLight_lightPosition[MAP_SIZE * MAP_SIZE][3];
-	alignas(16) glm::vec4 spotLight_spotDirection[MAP_SIZE * MAP_SIZE][3];
-	alignas(16) glm::vec4 lightColorSpot;
+	alignas(16) glm::vec3 rearLightPosition[MAX_LIT_CARS][2];  //left and right
+	alignas(16) glm::vec3 rearLightDirection[MAX_LIT_CARS][2];
+	alignas(16) glm::vec4 rearLightColor[MAX_LIT_CARS][2];
 };
 
-struct RoadPosition {
-	glm::vec3 pos;
-	int type;
-	float rotation;
-};
-
-//Road Types
-enum RoadType {
-	STRAIGHT = 0,
-	LEFT = 1,
-	RIGHT = 2,
-	NONE = 3
+//Road, one element per instance of the storage buffers; Car and Environment, one per instance of the instance buffers
+struct InstanceTransform {
+	alignas(16) glm::mat4 mMat;   //Model/World Matrix
+	alignas(16) glm::mat4 nMat;   //Normal Matrix
 };
 
-struct Checkpoint {
-	glm::vec3 position;
-	glm::vec3 pointA;
-	glm::vec3 pointB;
+struct RoadSpotLights {
+	alignas(16) glm::vec4 spotLight_lightPosition[3];
+	alignas(16) glm::vec4 spotLight_spotDirection[3];
 };
 
-//Environment
-struct EnvironmentUniformBufferObject {
-	alignas(16) glm::mat4 mvpMat[MAP_SIZE * MAP_SIZE];
-	alignas(16) glm::mat4 mMat[MAP_SIZE * MAP_SIZE];
-	alignas(16) glm::mat4 nMat[MAP_SIZE * MAP_SIZE];
+// The draws of the road pass, in the order of their instances in the road table
+enum RoadDraw { ROAD_STRAIGHT, ROAD_TURN_LEFT, ROAD_TURN_RIGHT, ROAD_TILE, ROAD_CHECKPOINT, ROAD_DRAWS };
+
+// World and normal matrices of the instances that never move, computed once when the map is loaded
+struct StaticInstanceCache {
+	// All the road pass in one table, the instances of a draw from roadFirst[draw]. The spot lights are
+	// parallel to it (zeroed for tiles and checkpoints); both hold at least one element, as storage buffers
+	std::vector<InstanceTransform> road;
+	std::vector<RoadSpotLights> roadLights;
+	uint32_t roadFirst[ROAD_DRAWS];
+	uint32_t roadCount[ROAD_DRAWS];
+	std::vector<std::vector<InstanceTransform>> environment;
+	// World space bounding spheres (xyz center, w radius) of the instances, for the culling
+	std::vector<glm::vec4> roadSpheres;
+	std::vector<std::vector<glm::vec4>> environmentSpheres;
 };
 
 struct Vertex {
@@ -86,6 +71,7 @@ struct Vertex {
 //Skybox
 struct skyBoxUniformBufferObject {
 	alignas(16) glm::mat4 mvpMat;
+	alignas(4) int phase;  //Selects the sky textures of the current day phase
 };
 
 struct skyBoxVertex {
@@ -94,6 +80,17 @@ struct skyBoxVertex {
 
 // MAIN
 class CG_PRJ : public BaseProject {
+public:
+	// Cars in the race, the player included, to be set before run()
+	void setCarCount(int count) {
+		carCount = count;
+	}
+
+	// Frustum culling of the road and the environment, on by default; to be set before run()
+	void setFrustumCulling(bool enabled) {
+		frustumCulling = enabled;
+	}
+
 protected:
 	//Global
 	DescriptorSetLayout DSLGlobal;
@@ -109,7 +106,6 @@ protected:
 
 	//Cp
 	Model Mcp;
-	DescriptorSet DScp;
 
 	//Road
 	DescriptorSetLayout DSLroad;
@@ -119,23 +115,37 @@ protected:
 	Model MturnLeft;
 	Model MturnRight;
 	Model Mtile;
-	DescriptorSet DSstraightRoad;
-	DescriptorSet DSturnLeft;
-	DescriptorSet DSturnRight;
-	DescriptorSet DStile;
+	DescriptorSet DSroad;					// road pieces, tiles and checkpoints
+	InstanceBuffer IBroadVisible;			// road table indices of the instances drawn (all of them without culling)
+	DrawList DLroad;
+	// Car lights of the road descriptor set, written once per frame
+	SharedBuffer SBcarLights;
+
+	// Cars and environment: mesh at binding 0, world and normal matrices of the instances at binding 1
+	VertexDescriptor VDinstanced;
+
+	// Road pieces and checkpoints share one geometry pool, cars and environment another
+	GeometryPool GPmesh;
+	GeometryPool GPinstanced;
 
 	//Car
 	DescriptorSetLayout DSLcar;
 	Pipeline Pcar;
 	std::vector<Model> Mcar;
-	std::vector<DescriptorSet> DScar;
+	DescriptorSet DScar;
+	InstanceBuffer IBcars;					// rewritten every frame, the cars of a model are consecutive
+	std::vector<uint32_t> carModelFirst;	// first instance and number of cars of each model
+	std::vector<uint32_t> carModelCount;
 
 	// Environment
 	DescriptorSetLayout DSLenvironment;
 	Pipeline Penv;
 	std::vector<Model> Menv;
 	Texture Tenv;
-	std::vector<DescriptorSet> DSenvironment;
+	DescriptorSet DSenvironment;
+	InstanceBuffer IBenvironment;			// the instances drawn of each model one after the other, static without culling
+	std::vector<uint32_t> envModelFirst;
+	DrawList DLenvironment;
 	std::map<int, std::string> envFileNames;
 	const std::string envModelsPath = "models/environment";
 	std::vector<std::vector<std::pair <int, int>>> envIndexesPerModel;
@@ -161,43 +171,25 @@ protected:
 	const glm::vec3 upVector = glm::vec3(0, 1, 0);						//Up Vector
 
 	/******* CARS PARAMETERS *******/
-	float initialRotation = 0.0f;
 	const float ROT_SPEED = glm::radians(120.0f);
 	const float MOVE_SPEED = 2.0f;
-	const float carAcceleration = 8.0f;						// [m/s^2]
-	const float brakingStrength = 30.0f;
-	const float gravity = 9.81f;								// [m/s^2]
-	const float friction = 0.7f * gravity;
-	float carSteeringSpeed = glm::radians(75.0f);
-	const float carDamping = 5.0f;
-
-	std::vector<glm::vec3> startingCarPos;
-	std::vector<glm::vec3> updatedCarPos;
-	std::vector<float> carVelocity;
-	std::vector<float> steeringAng;
-	std::vector<float> nextAng; 
-
-	glm::vec3 oldUpdatedCarPos; // only for playerCar
-
-	// Assume initialRotation is the rotation applied to the car model at spawn, represented as a quaternion
-	std::map<int, glm::quat> steeringRotation; 
-	std::map<int, glm::vec3> forwardDir; 
-	std::vector<std::map<int, int>> nextRightTurn; 
-	std::vector<std::map<int, int>> nextLeftTurn; 
-	std::map<int, int> car_laps; 
-	std::map<int, bool> intermediateCheckpointIsCrossed; // for bot cars
 
+	// Poses of the previous simulation step, and the poses rendered in between
+	std::vector<glm::vec3> previousCarPos;
+	std::vector<float> previousSteeringAng;
+	std::vector<glm::vec3> renderCarPos;
+	std::vector<float> renderSteeringAng;
 
 	/******* MAP PARAMETERS *******/
 	nlohmann::json mapFile;
-	const int MAP_CENTER = MAP_SIZE / 2;
-	std::vector<glm::vec3> roadsPosition; 
-	std::vector<std::vector<RoadPosition>> mapLoaded;
-	std::vector<std::vector<std::pair<int, int>>> mapIndexes; // 0: STRAIGHT, 1: LEFT, 2: RIGHT
-	std::map<int, Checkpoint> checkpoints;
-	glm::vec3 end_position = glm::vec3(0.0f, 0.0f, 0.0f);
-	glm::vec3 center_road_position = glm::vec3(0.0f, 0.0f, 0.0f); 
-	float checkpointOffset = 6.0f; 
+	std::string mapFilePath = "config/map_ina.json";	// the benchmark script can choose another map
+	StaticInstanceCache instanceCache;
+
+	/******* CULLING *******/
+	// With culling, the visible instances are compacted and the command buffers recorded every frame
+	bool frustumCulling = true;
+	Frustum frustum;
+	std::vector<uint32_t> cullScratch;	// visible instances of an environment model, sized once
 
 	/************ DAY PHASES PARAMETERS *****************/
 	int scene = 0;
@@ -214,13 +206,20 @@ protected:
 	glm::vec3 startingColor = glm::vec3(0.0f, 0.0f, 0.0f);
 	glm::vec3 finalColor = glm::vec3(0.0f, 0.0f, 0.0f);
 
-	/******* RACE PARAMETERS *******/
-	int maxLaps = 20;
-	int currentCheckpoint;
-	const int player_car = 0;
-	bool raceIsEnded = false; 
-	int winner; 
-	float sensitivityValue = 8.0f; 
+	/******* RACE *******/
+	// Track, cars and race rules: the application renders race.state and plays the sounds of its events
+	RaceSimulation race;
+	const int player_car = RaceSimulation::playerCar;
+	int carCount = 3;
+	const int carModels = 3;	// models/cars/car_<n>.mgcg, shared round-robin by the cars
+	float sensitivityValue = 8.0f;
+
+	/******* PER-FRAME UNIFORM STAGING *******/
+	// Uniform blocks are rebuilt here every frame and copied to the GPU, so the frame loop never touches the heap
+	GlobalUniformBufferObject g_ubo{};
+	skyBoxUniformBufferObject sb_ubo{};
+	CarLightsUniformBufferObject carLights_ubo{};
+	std::vector<void *> carInstances;	// the car matrices are built in place, in the instance buffer region of the frame
 
 	void setWindowParameters() {
 		// window size, titile and initial background
@@ -228,6 +227,7 @@ protected:
 		windowHeight = 600;
 		windowTitle = "CG_PRJ";
 		windowResizable = GLFW_TRUE;
+		recordEveryFrame = frustumCulling;	// the draw lists change every frame
 
 		ar = (float)windowWidth / (float)windowHeight;
 	}
@@ -241,24 +241,6 @@ protected:
 		ar = (float)w / (float)h;
 	}
 
-	//Helper Functions
-	std::unordered_map<std::string, RoadType> stringToEnumRT = {
-		{"STRAIGHT", RoadType::STRAIGHT},
-		{"LEFT", RoadType::LEFT},
-		{"RIGHT", RoadType::RIGHT},
-		{"NONE", RoadType::NONE},
-	};
-
-	RoadType getRTEnumFromString(const std::string& enumString) {
-		auto it = stringToEnumRT.find(enumString);
-		if (it != stringToEnumRT.end()) {
-			return it->second;
-		}
-		else {
-			throw std::invalid_argument("Invalid enum string: " + enumString);
-		}
-	}
-
 	// Initialize everything needed for the application
 	void localInit() {
 		//Audio
@@ -271,36 +253,35 @@ protected:
 			exit(1);
 		}
 
-		startingCarPos.resize(NUM_CARS);
-		updatedCarPos.resize(NUM_CARS);
-		carVelocity.resize(NUM_CARS);
-		steeringAng.resize(NUM_CARS);
-		nextAng.resize(NUM_CARS); 
-		for (int i = 0; i < NUM_CARS; i++) {
-			carVelocity[i] = 0.0f;
-			steeringAng[i] = 0.0f;
-		}
-		currentCheckpoint = 0; 
-
 		InitDSL();
 		InitVD();
 		InitPipelines();
-		InitModels();
 
-		//Map Grid Initialization
-		mapFile = LoadMapFile();
-		LoadMap(mapFile);
-
-		//Environment models
+		//Models and textures: decoded in parallel, then uploaded in order
+		AssetLoader loader(loadThreads);
+		InitModels(loader);
 		readModels(envModelsPath);
 		Menv.resize(envFileNames.size());
 		for (const auto& [key, value] : envFileNames) {
-			Menv[key].init(this, &VD, value, MGCG);
+			loader.model(Menv[key], this, &VDinstanced, value, MGCG, &GPinstanced);
 		}
-		InitEnvironment();
+		LoadTextures(loader);
+		loader.finish();
+		GPmesh.upload();
+		GPinstanced.upload();
 
-		//Textures
-		LoadTextures();
+		//Map Grid and race initialization
+		mapFile = LoadMapFile();
+		race.init(mapFile, carCount);
+		camPos = glm::vec3(race.map.startPosition.x, camHeight, race.map.startPosition.z - camDist);
+		previousCarPos = race.state.cars.pos;
+		previousSteeringAng = race.state.cars.steeringAng;
+		renderCarPos = previousCarPos;
+		renderSteeringAng = previousSteeringAng;
+
+		//Environment placement
+		InitEnvironment();
+		InitInstanceCache();
 
 		UpdatePools();
 	}
@@ -315,29 +296,27 @@ protected:
 
 		//Skybox
 		DSLSkyBox.init(this, {
-			{ 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, sizeof(skyBoxUniformBufferObject), 1 },
-			{ 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 1 },
-			{ 2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 1, 1 }
+			{ 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS, sizeof(skyBoxUniformBufferObject), 1 },
+			{ 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 2 },	// clouds, starmap
+			{ 2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 2, 4 }	// sunrise, day, sunset, constellations
 		});
 
 		//Road
 		DSLroad.init(this, {
 			{ 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 1 },
-			{ 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, sizeof(RoadUniformBufferObject), 1 },
+			{ 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, sizeof(InstanceTransform), 1 },
 			{ 2, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(CarLightsUniformBufferObject), 1 },
-			{ 3, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(RoadLightsUniformBufferObject), 1 }
+			{ 3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(RoadSpotLights), 1 }
 		});
 
-		//Car
+		//Car (the matrices come from the instance buffer)
 		DSLcar.init(this, {
-			{ 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, sizeof(CarUniformBufferObject), 1 },
-			{ 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 1 }
+			{ 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 1 }
 		});
 
-		//Environment
+		//Environment (the matrices come from the instance buffer)
 		DSLenvironment.init(this, {
-			{ 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, sizeof(EnvironmentUniformBufferObject), 1 },
-			{ 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 1 }
+			{ 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 1 }
 		});
 	}
 
@@ -351,13 +330,37 @@ protected:
 			{ 0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(skyBoxVertex, pos), sizeof(glm::vec3), POSITION }
 		});
 
+		//Road: the index in the road table of each instance drawn at binding 1
 		VD.init(this, {
-			{ 0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX }
+			{ 0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX },
+			{ 1, sizeof(uint32_t), VK_VERTEX_INPUT_RATE_INSTANCE }
+		}, {
+			{ 0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, pos), sizeof(glm::vec3), POSITION },
+			{ 0, 1, VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, uv), sizeof(glm::vec2), UV },
+			{ 0, 2, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, normal), sizeof(glm::vec3), NORMAL },
+			{ 1, 3, VK_FORMAT_R32_UINT, 0, sizeof(uint32_t), OTHER }
+		});
+
+		//A mat4 attribute takes four locations, one per column
+		VDinstanced.init(this, {
+			{ 0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX },
+			{ 1, sizeof(InstanceTransform), VK_VERTEX_INPUT_RATE_INSTANCE }
 		}, {
 			{ 0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, pos), sizeof(glm::vec3), POSITION },
 			{ 0, 1, VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, uv), sizeof(glm::vec2), UV },
 			{ 0, 2, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, normal), sizeof(glm::vec3), NORMAL },
+			{ 1, 3, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(InstanceTransform, mMat), sizeof(glm::vec4), OTHER },
+			{ 1, 4, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(InstanceTransform, mMat) + 16, sizeof(glm::vec4), OTHER },
+			{ 1, 5, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(InstanceTransform, mMat) + 32, sizeof(glm::vec4), OTHER },
+			{ 1, 6, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(InstanceTransform, mMat) + 48, sizeof(glm::vec4), OTHER },
+			{ 1, 7, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(InstanceTransform, nMat), sizeof(glm::vec4), OTHER },
+			{ 1, 8, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(InstanceTransform, nMat) + 16, sizeof(glm::vec4), OTHER },
+			{ 1, 9, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(InstanceTransform, nMat) + 32, sizeof(glm::vec4), OTHER },
+			{ 1, 10, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(InstanceTransform, nMat) + 48, sizeof(glm::vec4), OTHER }
 		});
+
+		GPmesh.init(this, &VD);
+		GPinstanced.init(this, &VDinstanced);
 	}
 
 	//Pipelines
@@ -367,48 +370,35 @@ protected:
 		PSkyBox.setAdvancedFeatures(VK_COMPARE_OP_LESS_OR_EQUAL, VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, false);
 		Proad.init(this, &VD, "shaders/RoadVert.spv", "shaders/RoadFrag.spv", { &DSLGlobal, &DSLroad });
 		Proad.setAdvancedFeatures(VK_COMPARE_OP_LESS_OR_EQUAL, VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, false);
-		Pcar.init(this, &VD, "shaders/CarVert.spv", "shaders/CarFrag.spv", { &DSLGlobal, &DSLcar });
-		Penv.init(this, &VD, "shaders/EnvVert.spv", "shaders/EnvFrag.spv", { &DSLGlobal, &DSLenvironment });
+		Pcar.init(this, &VDinstanced, "shaders/CarVert.spv", "shaders/CarFrag.spv", { &DSLGlobal, &DSLcar });
+		Penv.init(this, &VDinstanced, "shaders/EnvVert.spv", "shaders/EnvFrag.spv", { &DSLGlobal, &DSLenvironment });
 		Penv.setAdvancedFeatures(VK_COMPARE_OP_LESS_OR_EQUAL, VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, false);
 	}
 
 	//Models
-	void InitModels()
+	void InitModels(AssetLoader &loader)
 	{
-		MSkyBox.init(this, &VDSkyBox, "models/SkyBoxCube.obj", OBJ);
-
-		Mcar.resize(NUM_CARS);
-		for (int i = 0; i < Mcar.size(); i++) {
-			Mcar[i].init(this, &VD, "models/cars/car_" + std::to_string(i) + ".mgcg", MGCG);
-		}
-
-		MstraightRoad.init(this, &VD, "models/road/straight.mgcg", MGCG);
-		MturnLeft.init(this, &VD, "models/road/turn.mgcg", MGCG);
-		MturnRight.init(this, &VD, "models/road/turn.mgcg", MGCG);
-		Mtile.init(this, &VD, "models/road/green_tile.mgcg", MGCG);
-		Mcp.init(this, &VD, "models/checkpoint.mgcg", MGCG);
+		loader.model(MSkyBox, this, &VDSkyBox, "models/SkyBoxCube.obj", OBJ);
+
+		Mcar.resize(std::min(carCount, carModels));
+		carModelFirst.resize(Mcar.size());
+		carModelCount.resize(Mcar.size());
+		for (int i = 0, first = 0; i < Mcar.size(); i++) {
+			loader.model(Mcar[i], this, &VDinstanced, "models/cars/car_" + std::to_string(i) + ".mgcg", MGCG, &GPinstanced);
+			// Car i uses the model i % Mcar.size()
+			carModelFirst[i] = first;
+			carModelCount[i] = (carCount - i + Mcar.size() - 1) / Mcar.size();
+			first += carModelCount[i];
+		}
+
+		loader.model(MstraightRoad, this, &VD, "models/road/straight.mgcg", MGCG, &GPmesh);
+		loader.model(MturnLeft, this, &VD, "models/road/turn.mgcg", MGCG, &GPmesh);
+		loader.model(MturnRight, this, &VD, "models/road/turn.mgcg", MGCG, &GPmesh);
+		loader.model(Mtile, this, &VD, "models/road/green_tile.mgcg", MGCG, &GPmesh);
+		loader.model(Mcp, this, &VD, "models/checkpoint.mgcg", MGCG, &GPmesh);
 	}
 
 
-	//Initialize the mapLoaded and mapIndexes with the default values
-	void InitMap()
-	{
-		mapIndexes.resize(DIRECTIONS);
-		mapLoaded.resize(MAP_SIZE, std::vector<RoadPosition>(MAP_SIZE));
-		for (int i = 0; i < mapLoaded.size(); i++) {
-			for (int j = 0; j < mapLoaded[i].size(); j++) {
-				std::pair <int, int> index = std::make_pair(i, j);
-				float x = SCALING_FACTOR * (j - MAP_CENTER);
-				float z = SCALING_FACTOR * (i - MAP_CENTER);
-				int type = RoadType::NONE;
-				mapLoaded[i][j].pos = glm::vec3(x, 0.0f, z);
-				mapLoaded[i][j].type = type;
-				mapLoaded[i][j].rotation = 0.0f;
-				mapIndexes[type].push_back(index);
-			}
-		}
-	}
-
 	//Reads the models from the environment folder
 	void readModels(std::string path) {
 		std::vector<std::string> directories;
@@ -447,226 +437,238 @@ protected:
 
 	//Loads the JSON
 	nlohmann::json LoadMapFile() {
-		nlohmann::json json;
-
-		std::ifstream infile("config/map_ina.json");
-		if (!infile.is_open()) {
-			std::cerr << "Error opening file!" << std::endl;
-			exit(1);
+		if (benchmarking && !benchmark.map.empty()) {
+			mapFilePath = benchmark.map;
 		}
+		inputRecorder.map = mapFilePath;
 
-		// Parse the JSON content
-		infile >> json;
-		infile.close();
+		Asset map = readAsset(mapFilePath);
+		return nlohmann::json::parse(map.data(), map.data() + map.size());
+	}
+
+	//Environment
+	void InitEnvironment()
+	{
+		std::random_device rd;										//Obtain a random number from hardware
+		std::mt19937 gen(benchmarking ? benchmark.seed : rd());		//Seed the generator, fixed for the benchmark
+		std::uniform_int_distribution<> distr(-5, Menv.size() - 1);	//Define the range (negative values are for blank tiles)
 
-		return json;
+		//Random distribution of environment models on the map
+		envIndexesPerModel.resize(Menv.size());
+		for (int i = 0; i < race.map.indexes[RoadType::NONE].size(); i++) {
+			int modelNumber = distr(gen);
+			if (modelNumber >= 0) {
+				std::pair <int, int> index = race.map.indexes[RoadType::NONE][i];
+				envIndexesPerModel[modelNumber].push_back(index);
+			}
+		}
 	}
 
-	//Initialize the mapLoaded and mapIndexes
-	void LoadMap(nlohmann::json& json)
+	//Computes once the world/normal matrices and the spot lights of the instances that never move
+	void InitInstanceCache()
 	{
-		InitMap();
-		std::pair<int, int> previousItemIndex = std::make_pair(json["start"]["row"], json["start"]["col"]);
-
-		// Set the initial rotation of the car
-		initialRotation = ((int)json["_map"][1]["col"] - previousItemIndex.second > 0) ? 270.0f : 
-							((int)json["_map"][1]["col"] - previousItemIndex.second < 0) ? 90.0f :
-							((int)json["_map"][1]["row"] - previousItemIndex.first < 0) ? 0.0f : 180.0f; // Set the initial rotation 
-		mapLoaded[previousItemIndex.first][previousItemIndex.second].rotation = initialRotation;
- 
-		int lastCpIndex = 0;
-		for (const auto& [jsonKey, jsonValues] : json.items()) {
-			if (jsonKey == "_map") {
-				for (const auto& [mapKey, mapValues] : jsonValues.items()) { //Retrieves the road position and type and creates it
-
-					std::pair <int, int> index = std::make_pair(mapValues["row"], mapValues["col"]);
-					RoadType type = getRTEnumFromString(mapValues["type"]);
-					// Add the road piece to the map
-					mapLoaded[index.first][index.second].type = type;
-
-					// Add the index to the corresponding type and remove the index from the NONE type
-					mapIndexes[type].push_back(index);
-					mapIndexes[RoadType::NONE].erase(std::remove(mapIndexes[RoadType::NONE].begin(), mapIndexes[RoadType::NONE].end(), index), mapIndexes[RoadType::NONE].end());
-
-					rotationHandler(previousItemIndex, index, type);
-					previousItemIndex = index;
-
-					if (mapValues["type"] == "STRAIGHT" || mapValues["type"] == "LEFT" || mapValues["type"] == "RIGHT") {
-						roadsPosition.push_back(mapLoaded[index.first][index.second].pos);
-					}
+		// Storage buffers cannot be empty, so every array keeps at least one (unused) element
+		auto atLeastOne = [](size_t count) { return std::max<size_t>(count, 1); };
+
+		// The road table, filled in the order of RoadDraw
+		const RoadType types[] = { STRAIGHT, LEFT, RIGHT, NONE };
+		uint32_t first = 0;
+		for (int d = 0; d < ROAD_DRAWS; d++) {
+			instanceCache.roadFirst[d] = first;
+			instanceCache.roadCount[d] = (uint32_t)(d == ROAD_CHECKPOINT ? race.map.checkpoints.size() * 2 : race.map.indexes[types[d]].size());
+			first += instanceCache.roadCount[d];
+		}
+		instanceCache.road.assign(atLeastOne(first), InstanceTransform{});
+		instanceCache.roadLights.assign(atLeastOne(first), RoadSpotLights{});
+		RoadSpotLights *straightRoadLights = instanceCache.roadLights.data() + instanceCache.roadFirst[ROAD_STRAIGHT];
+		RoadSpotLights *turnRightLights = instanceCache.roadLights.data() + instanceCache.roadFirst[ROAD_TURN_RIGHT];
+		RoadSpotLights *turnLeftLights = instanceCache.roadLights.data() + instanceCache.roadFirst[ROAD_TURN_LEFT];
+
+		//World and normal matrices: roads turned by their rotation, tiles and environment only translated
+		BuildTileInstances(race.map.indexes[STRAIGHT], true, glm::vec3(0.0f), instanceCache.road.data() + instanceCache.roadFirst[ROAD_STRAIGHT]);
+		BuildTileInstances(race.map.indexes[RIGHT], true, glm::vec3(0.0f), instanceCache.road.data() + instanceCache.roadFirst[ROAD_TURN_RIGHT]);
+		BuildTileInstances(race.map.indexes[LEFT], true, glm::vec3(0.0f), instanceCache.road.data() + instanceCache.roadFirst[ROAD_TURN_LEFT]);
+		BuildTileInstances(race.map.indexes[NONE], false, glm::vec3(0.0f), instanceCache.road.data() + instanceCache.roadFirst[ROAD_TILE]);
+
+		//Straight roads (spot lights)
+		for (int i = 0; i < race.map.indexes[STRAIGHT].size(); i++) {
+			int n = race.map.indexes[STRAIGHT][i].first;
+			int m = race.map.indexes[STRAIGHT][i].second;
+
+			bool oneCondition = false;
+			bool m_oneCondition = false;
+			int directions[4][2] = { {-1, 0}, {1, 0}, {0, -1}, {0, 1} }; // Up, Down, Left, Right
+
+			for (int i = 0; i < 4; i++) {
+				int newN = n + directions[i][0];
+				int newM = m + directions[i][1];
+				if (newN < 0 || newM < 0 || newN >= race.map.size || newM >= race.map.size) {
+					continue;
 				}
-			}
-			else if (jsonKey == "checkpoints") {
-				if (jsonValues.size() != 0) {
-					for (const auto& [cpKey, cpValues] : jsonValues.items()) { //Retrieves the checkpoint position and rotation and creates it
-						std::pair <int, int> checkpointPosIndex = std::make_pair(cpValues["row"], cpValues["col"]);
-						lastCpIndex = std::stoi(cpKey);
-						glm::vec3 position = mapLoaded[checkpointPosIndex.first][checkpointPosIndex.second].pos;
-						float rotation = mapLoaded[checkpointPosIndex.first][checkpointPosIndex.second].rotation;
-						initCheckpoint(position, rotation, lastCpIndex);
+
+				// Check if the neighboring cell has type 1 or 2
+				if (race.map.tiles[newN][newM].type == 1 || race.map.tiles[newN][newM].type == 2) {
+					// Identify the condition based on the direction
+					if (directions[i][0] >= 0 && directions[i][1] >= 0) {
+						oneCondition = true;
+					} else if (directions[i][0] <= 0 && directions[i][1] <= 0) {
+						m_oneCondition = true;
 					}
 				}
 			}
-			else if (jsonKey == "start") { //Sets the starting position of the cars
-				std::pair <int, int> startPosIndex = std::make_pair(jsonValues["row"], jsonValues["col"]);
-				startingCarPos[player_car] = mapLoaded[startPosIndex.first][startPosIndex.second].pos;
-				for (int i = 0; i < startingCarPos.size(); i++) {
-					if (i != player_car) {
-						startingCarPos[i] = startingCarPos[player_car] + glm::vec3(
-								glm::rotate(glm::mat4(1.0f), glm::radians(initialRotation), glm::vec3(0.0f, 1.0f, 0.0f)) *
-								glm::vec4(0.0f, 0.0f, -4.0f * i, 1.0f));
-					}
-				}
-				camPos = glm::vec3(startingCarPos[player_car].x, camHeight, startingCarPos[player_car].z - camDist);
-				updatedCarPos = startingCarPos;
 
-			}
-			else if (jsonKey == "end") { //Sets the end position of the track
-				std::pair <int, int> endPosIndex;
-				if (jsonValues == nullptr) {
-					endPosIndex = std::make_pair(json["_map"].back()["row"], json["_map"].back()["col"]);
-				}
-				else {
-					endPosIndex = std::make_pair(jsonValues["row"], jsonValues["col"]);
-					maxLaps = 1;
-				}
-				if (checkpoints.size() > 0) lastCpIndex++;
-				end_position = mapLoaded[endPosIndex.first][endPosIndex.second].pos;
-				float rotation = mapLoaded[endPosIndex.first][endPosIndex.second].rotation;
-				initCheckpoint(end_position, rotation, lastCpIndex);
+			glm::mat4 rotation = glm::rotate(glm::mat4(1.0f), glm::radians(race.map.tiles[n][m].rotation), glm::vec3(0, 1, 0));
+			glm::mat4 transform = glm::translate(glm::mat4(1.0f), race.map.tiles[n][m].pos) * rotation;
+
+			// Spot positions //0 middle, 1 previous, 2 next (the one furthest from the model)
+			straightRoadLights[i].spotLight_lightPosition[0] = transform * glm::vec4(-4.9f, 4.9f, -0.2f, 1.0f);
+			straightRoadLights[i].spotLight_spotDirection[0] = rotation * glm::vec4(0.4f, -1.0f, 0.0f, 1.0f);
+
+			if (!oneCondition) {
+				straightRoadLights[i].spotLight_lightPosition[1] = transform * glm::vec4(4.9f, 4.9f, 7.8f, 1.0f);
+				straightRoadLights[i].spotLight_spotDirection[1] = rotation * glm::vec4(-0.4f, -1.0f, 0.0f, 1.0f);
 			}
 
+			if (!m_oneCondition) {
+				straightRoadLights[i].spotLight_lightPosition[2] = transform * glm::vec4(4.9f, 4.9f, -7.8f, 1.0f);
+				straightRoadLights[i].spotLight_spotDirection[2] = rotation * glm::vec4(-0.4f, -1.0f, 0.0f, 1.0f);
+			}
 		}
 
-		// Initialize the car laps and the next turn for each car
-		nextRightTurn.resize(NUM_CARS);
-		nextLeftTurn.resize(NUM_CARS);
-		for (int i = 0; i < NUM_CARS; i++) {
-			car_laps[i] = 0;
-			intermediateCheckpointIsCrossed[i] = false;
+		//Turn Right (spot lights)
+		for (int i = 0; i < race.map.indexes[RIGHT].size(); i++) {
+			int n = race.map.indexes[RIGHT][i].first;
+			int m = race.map.indexes[RIGHT][i].second;
 
-			for (int j = 0; j < maxLaps; j++) {
-				nextRightTurn[i][j] = 0;
-				nextLeftTurn[i][j] = 0;
-			}
+			glm::mat4 rotation = glm::rotate(glm::mat4(1.0f), glm::radians(race.map.tiles[n][m].rotation), glm::vec3(0, 1, 0));
+			glm::mat4 transform = glm::translate(glm::mat4(1.0f), race.map.tiles[n][m].pos) * rotation;
+
+			turnRightLights[i].spotLight_lightPosition[0] = transform * glm::vec4(-4.85f, 4.9f, -5.9f, 1.0f);
+			turnRightLights[i].spotLight_spotDirection[0] = rotation * glm::vec4(0.4f, -1.0f, 0.4f, 1.0f);
 		}
 
-		int mid = (roadsPosition.size() - 1) / 2;
-		center_road_position = roadsPosition[mid];
-	}
+		//Turn Left (spot lights)
+		for (int i = 0; i < race.map.indexes[LEFT].size(); i++) {
+			int n = race.map.indexes[LEFT][i].first;
+			int m = race.map.indexes[LEFT][i].second;
 
-	void initCheckpoint(glm::vec3& checkpointPos, float rotation, int id)
-	{
-		glm::mat4 rotationMatrix = glm::rotate(glm::mat4(1.0f), glm::radians(rotation), glm::vec3(0.0f, 1.0f, 0.0f));
-		checkpoints[id].position = checkpointPos;
-		checkpoints[id].pointA = checkpointPos + glm::vec3(rotationMatrix * glm::vec4(-checkpointOffset, 0.0f, checkpointOffset, 1.0f));
-		checkpoints[id].pointB = checkpointPos + glm::vec3(rotationMatrix * glm::vec4(checkpointOffset, 0.0f, checkpointOffset, 1.0f));
-	}
+			glm::mat4 rotation = glm::rotate(glm::mat4(1.0f), glm::radians(race.map.tiles[n][m].rotation - 90.0f), glm::vec3(0, 1, 0));
+			glm::mat4 transform = glm::translate(glm::mat4(1.0f), race.map.tiles[n][m].pos) * rotation;
 
-	//Handles the rotation of the road pieces
-	void rotationHandler(std::pair<int, int>& previousItemIndex, std::pair<int, int>& index, int type)
-	{
-		//if the current item is a turn depending on the current rotation and the type of the turn, the rotation is updated
-		int dRow = previousItemIndex.first - index.first;    // x difference
-		int dCol = previousItemIndex.second - index.second;  // y difference
-
-		if (dRow != 0 && dCol != 0) {
-			// Row and Column are both different from the previous road block, which is an error
-			std::cerr << "Invalid map configuration, Row and Column are both different from the previous road block"
-				<< ((abs(dRow) > abs(dCol)) ? " (Col problem)" : " (Row problem)") << std::endl;
-			std::cerr << "The road blocks are not connected or in wrong order in the map file" << std::endl;
-			std::cerr << "Previous road block: " << previousItemIndex.first << " " << previousItemIndex.second << std::endl;
-			std::cerr << "Current road block: " << index.first << " " << index.second << std::endl;
-			std::cerr << "Rotation defaulted to 0.0f" << std::endl;
+			turnLeftLights[i].spotLight_lightPosition[0] = transform * glm::vec4(-5.8f, 5.0f, 4.65f, 1.0f);
+			turnLeftLights[i].spotLight_spotDirection[0] = rotation * glm::vec4(0.4f, -1.0f, -0.4f, 1.0f);
 		}
-		else {
-			if (dRow > 0)
-				mapLoaded[index.first][index.second].rotation = (type == LEFT) ? 270.0f : (type == RIGHT) ? 0.0f : 0.0f;
-			else if (dRow < 0)
-				mapLoaded[index.first][index.second].rotation = (type == LEFT) ? 90.0f : (type == RIGHT) ? 180.0f : 0.0f;
-			else if (dCol > 0)
-				mapLoaded[index.first][index.second].rotation = (type == LEFT) ? 0.0f : (type == RIGHT) ? 90.0f : 90.0f;
-			else if (dCol < 0)
-				mapLoaded[index.first][index.second].rotation = (type == LEFT) ? 180.0f : (type == RIGHT) ? 270.0f : 90.0f;
+
+		//Checkpoints: the two poles of each one
+		std::vector<glm::vec3> polesPos;
+		for (const auto &[id, checkpoint] : race.map.checkpoints) {
+			polesPos.push_back(checkpoint.pointA);
+			polesPos.push_back(checkpoint.pointB);
 		}
-	}
+		InstanceMatrices::build(nullptr, polesPos.data(), nullptr, 0.0f, (int)polesPos.size(),
+								instanceCache.road.data() + instanceCache.roadFirst[ROAD_CHECKPOINT], sizeof(InstanceTransform));
 
-	//Environment
-	void InitEnvironment()
-	{
-		std::random_device rd;										//Obtain a random number from hardware
-		std::mt19937 gen(rd());										//Seed the generator
-		std::uniform_int_distribution<> distr(-5, Menv.size() - 1);	//Define the range (negative values are for blank tiles)
+		//Environment
+		instanceCache.environment.resize(Menv.size());
+		for (int i = 0; i < Menv.size(); i++) {
+			instanceCache.environment[i].assign(atLeastOne(envIndexesPerModel[i].size()), InstanceTransform{});
+			BuildTileInstances(envIndexesPerModel[i], false, glm::vec3(0.0f, +0.2f, 0.0f), instanceCache.environment[i].data());
+		}
 
-		//Random distribution of environment models on the map
-		envIndexesPerModel.resize(Menv.size());
-		for (int i = 0; i < mapIndexes[RoadType::NONE].size(); i++) {
-			int modelNumber = distr(gen);
-			if (modelNumber >= 0) {
-				std::pair <int, int> index = mapIndexes[RoadType::NONE][i];
-				envIndexesPerModel[modelNumber].push_back(index);
+		//Environment instances in the instance buffer, each model after the previous one
+		uint32_t envInstances = 0;
+		size_t largestModel = 1;
+		envModelFirst.resize(Menv.size());
+		for (int i = 0; i < Menv.size(); i++) {
+			envModelFirst[i] = envInstances;
+			envInstances += (uint32_t)instanceCache.environment[i].size();
+			largestModel = std::max(largestModel, envIndexesPerModel[i].size());
+		}
+		cullScratch.resize(largestModel);
+
+		//Bounding spheres, for the culling
+		instanceCache.roadSpheres.resize(instanceCache.road.size());
+		for (int d = 0; d < ROAD_DRAWS; d++) {
+			for (uint32_t i = instanceCache.roadFirst[d]; i < instanceCache.roadFirst[d] + instanceCache.roadCount[d]; i++) {
+				instanceCache.roadSpheres[i] = transformSphere(instanceCache.road[i].mMat, RoadModel(d).bounds);
+			}
+		}
+		instanceCache.environmentSpheres.resize(Menv.size());
+		for (int i = 0; i < Menv.size(); i++) {
+			instanceCache.environmentSpheres[i].resize(envIndexesPerModel[i].size());
+			for (int j = 0; j < envIndexesPerModel[i].size(); j++) {
+				instanceCache.environmentSpheres[i][j] = transformSphere(instanceCache.environment[i][j].mMat, Menv[i].bounds);
 			}
 		}
 	}
 
+	// Model drawn by each RoadDraw
+	const Model &RoadModel(int d) const {
+		const Model *models[ROAD_DRAWS] = { &MstraightRoad, &MturnLeft, &MturnRight, &Mtile, &Mcp };
+		return *models[d];
+	}
+
+	//World and normal matrices of models placed on the map tiles, optionally turned by the road rotation
+	void BuildTileInstances(const std::vector<std::pair<int, int>> &indexes, bool rotated, glm::vec3 offset, InstanceTransform *instances)
+	{
+		std::vector<glm::vec3> pos(indexes.size());
+		std::vector<float> yaw(indexes.size());
+		for (int i = 0; i < indexes.size(); i++) {
+			const RoadPosition &tile = race.map.tiles[indexes[i].first][indexes[i].second];
+			pos[i] = tile.pos + offset;
+			yaw[i] = glm::radians(tile.rotation);
+		}
+		InstanceMatrices::build(nullptr, pos.data(), rotated ? yaw.data() : nullptr, rotated ? glm::radians(baseObjectRotation) : 0.0f,
+								(int)indexes.size(), instances, sizeof(InstanceTransform));
+	}
+
 	//Textures
-	void LoadTextures()
+	void LoadTextures(AssetLoader &loader)
 	{
-		TSkyBox.init(this, "textures/starmap_g4k.jpg");
-		Tenv.init(this, "textures/Textures_City.png");
-		TStars.init(this, "textures/constellation_figures.png");
-		Tclouds.init(this, "textures/Clouds.jpg");
-		Tsunrise.init(this, "textures/SkySunrise.png");
-		Tday.init(this, "textures/SkyDay.png");
-		Tsunset.init(this, "textures/SkySunset.png");
+		loader.texture(TSkyBox, this, "textures/starmap_g4k.jpg");
+		loader.texture(Tenv, this, "textures/Textures_City.png");
+		loader.texture(TStars, this, "textures/constellation_figures.png");
+		loader.texture(Tclouds, this, "textures/Clouds.jpg");
+		loader.texture(Tsunrise, this, "textures/SkySunrise.png");
+		loader.texture(Tday, this, "textures/SkyDay.png");
+		loader.texture(Tsunset, this, "textures/SkySunset.png");
 	}
 
 	// Update the Descriptor Sets Pools
 	void UpdatePools()
 	{
-		DPSZs.uniformBlocksInPool = 2 + 3 * 5 + Mcar.size() + Menv.size();			// summation of (#ubo * #DS) for each DSL	 (Gl SK + Road + Car + Env)
-		DPSZs.texturesInPool = 2 + 5 + Mcar.size() + Menv.size();					// summation of (#texure * #DS) for each DSL (SK*2 + Road + Car + Env)
-		DPSZs.setsInPool = 7 + Mcar.size() + Menv.size();							// summation of #DS for each DSL			 (Gl SK 5*Road + Car + Env)
+		DPSZs.uniformBlocksInPool = 2 + 1;											// summation of (#ubo * #DS) for each DSL	 (Gl SK + Road)
+		DPSZs.storageBlocksInPool = 2;												// summation of (#ssbo * #DS) for each DSL	 (Road)
+		DPSZs.texturesInPool = 6 + 1 + 1 + 1;										// summation of (#texure * #DS) for each DSL (SK*6 + Road + Car + Env)
+		DPSZs.setsInPool = 3 + 1 + 1;												// summation of #DS for each DSL			 (Gl SK Road + Car + Env)
 
 		std::cout << "Uniform Blocks in the Pool  : " << DPSZs.uniformBlocksInPool << "\n";
+		std::cout << "Storage Blocks in the Pool  : " << DPSZs.storageBlocksInPool << "\n";
 		std::cout << "Textures in the Pool        : " << DPSZs.texturesInPool << "\n";
 		std::cout << "Descriptor Sets in the Pool : " << DPSZs.setsInPool << "\n";
 	}
 
 	// Initialize pipelines and Descriptor Sets
 	void pipelinesAndDescriptorSetsInit() {
-		//Descriptor Set initialization
-		switch (scene) {
-		case 0:
-			DSSkyBox.init(this, &DSLSkyBox, { &Tclouds, &Tsunrise });
-			break;
-		case 1:
-			DSSkyBox.init(this, &DSLSkyBox, { &Tclouds, &Tday });
-			break;
-		case 2:
-			DSSkyBox.init(this, &DSLSkyBox, { &Tclouds, &Tsunset });
-			break;
-		default:
-			DSSkyBox.init(this, &DSLSkyBox, { &TSkyBox, &TStars });
-			break;
-		}
+		//Descriptor Set initialization: all the sky textures are bound, the phase is chosen in the shader
+		DSSkyBox.init(this, &DSLSkyBox, { &Tclouds, &TSkyBox, &Tsunrise, &Tday, &Tsunset, &TStars });
 
 		DSGlobal.init(this, &DSLGlobal, { });
-		DSstraightRoad.init(this, &DSLroad, { &Tenv });
-		DSturnLeft.init(this, &DSLroad, { &Tenv });
-		DSturnRight.init(this, &DSLroad, { &Tenv });
-		DStile.init(this, &DSLroad, { &Tenv });
-		DScp.init(this, &DSLroad, { &Tenv });
-
-		DScar.resize(NUM_CARS);
-		for (int i = 0; i < DScar.size(); i++) {
-			DScar[i].init(this, &DSLcar, { &Tenv });
-		}
-
-		DSenvironment.resize(Menv.size());
-		for (int i = 0; i < DSenvironment.size(); i++) {
-			DSenvironment[i].init(this, &DSLenvironment, { &Tenv });
-		}
+		SBcarLights.init(this, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, sizeof(CarLightsUniformBufferObject));
+		DSroad.init(this, &DSLroad, { &Tenv }, { 0, (int)instanceCache.road.size(), 0, (int)instanceCache.roadLights.size() },
+					{ nullptr, nullptr, &SBcarLights, nullptr });
+		IBroadVisible.init(this, &VD, 1, (uint32_t)instanceCache.road.size(), frustumCulling);
+		DLroad.init(this, ROAD_DRAWS, frustumCulling);
+
+		DScar.init(this, &DSLcar, { &Tenv });
+		IBcars.init(this, &VDinstanced, 1, carCount, true);
+		carInstances.resize(carCount);
+
+		DSenvironment.init(this, &DSLenvironment, { &Tenv });
+		IBenvironment.init(this, &VDinstanced, 1,
+						   envModelFirst.empty() ? 0 : envModelFirst.back() + (uint32_t)instanceCache.environment.back().size(), frustumCulling);
+		DLenvironment.init(this, (uint32_t)Menv.size(), frustumCulling);
+		UploadStaticInstances();
 
 		//Pipeline Creation
 		PSkyBox.create();
@@ -675,6 +677,73 @@ protected:
 		Penv.create();
 	}
 
+	// Copies the cached static instances in the storage buffers, shared by all the frames so written once.
+	// Without culling every instance is drawn: the instance buffers and the draw lists are written once too
+	void UploadStaticInstances() {
+		DSroad.map(0, instanceCache.road.data(), 1);
+		DSroad.map(0, instanceCache.roadLights.data(), 3);
+		if (frustumCulling) {
+			return;
+		}
+
+		uint32_t *roadIndices = static_cast<uint32_t *>(IBroadVisible.mapped(0));
+		for (uint32_t i = 0; i < instanceCache.road.size(); i++) {
+			roadIndices[i] = i;
+		}
+		for (int i = 0; i < Menv.size(); i++) {
+			IBenvironment.map(0, instanceCache.environment[i].data(), (uint32_t)instanceCache.environment[i].size(), envModelFirst[i]);
+		}
+
+		// The models placed nowhere by InitEnvironment are dropped here
+		DLroad.clear();
+		for (int d = 0; d < ROAD_DRAWS; d++) {
+			DLroad.add(RoadModel(d), instanceCache.roadCount[d], instanceCache.roadFirst[d]);
+		}
+		DLroad.upload(0);
+		DLenvironment.clear();
+		for (int i = 0; i < Menv.size(); i++) {
+			DLenvironment.add(Menv[i], (uint32_t)envIndexesPerModel[i].size(), envModelFirst[i]);
+		}
+		DLenvironment.upload(0);
+		std::cout << "Draw lists: " << DLroad.commands.size() << " road, " << DLenvironment.commands.size()
+				  << " environment (" << (Menv.size() - DLenvironment.commands.size()) << " empty skipped)\n";
+	}
+
+	// Compacts the road and environment instances inside the frustum in the regions of the frame,
+	// and rebuilds their draw lists. The command buffer of the frame is recorded after this
+	void CullStaticInstances(const glm::mat4 &vpMat, int currentImage) {
+		PROFILE_ZONE("FrustumCulling");
+		frustum.fromViewProjection(vpMat);
+
+		//Road: the indices of the visible instances, the shaders read the road table through them
+		uint32_t *roadVisible = static_cast<uint32_t *>(IBroadVisible.mapped(currentImage));
+		uint32_t visible = 0;
+		DLroad.clear();
+		for (int d = 0; d < ROAD_DRAWS; d++) {
+			uint32_t n = frustum.cull(instanceCache.roadSpheres.data(), instanceCache.roadFirst[d], instanceCache.roadCount[d],
+									  roadVisible + visible);
+			DLroad.add(RoadModel(d), n, visible);
+			visible += n;
+		}
+		DLroad.upload(currentImage);
+
+		//Environment: the matrices of the visible instances
+		char *envVisible = static_cast<char *>(IBenvironment.mapped(currentImage));
+		visible = 0;
+		DLenvironment.clear();
+		for (int i = 0; i < Menv.size(); i++) {
+			uint32_t n = frustum.cull(instanceCache.environmentSpheres[i].data(), 0, (uint32_t)envIndexesPerModel[i].size(),
+									  cullScratch.data());
+			for (uint32_t j = 0; j < n; j++) {
+				memcpy(envVisible + (visible + j) * sizeof(InstanceTransform), &instanceCache.environment[i][cullScratch[j]],
+					   sizeof(InstanceTransform));
+			}
+			DLenvironment.add(Menv[i], n, visible);
+			visible += n;
+		}
+		DLenvironment.upload(currentImage);
+	}
+
 	// Destroys pipelines and Descriptor Sets
 	void pipelinesAndDescriptorSetsCleanup() {
 		//Pipelines Cleanup
@@ -686,18 +755,17 @@ protected:
 		//Descriptor Set Cleanup
 		DSGlobal.cleanup();
 		DSSkyBox.cleanup();
-		DSstraightRoad.cleanup();
-		DSturnLeft.cleanup();
-		DSturnRight.cleanup();
-		DStile.cleanup();
-		DScp.cleanup();
-
-		for (int i = 0; i < DScar.size(); i++) {
-			DScar[i].cleanup();
-		}
-		for (int i = 0; i < DSenvironment.size(); i++) {
-			DSenvironment[i].cleanup();
-		}
+		DSroad.cleanup();
+		SBcarLights.cleanup();
+
+		IBroadVisible.cleanup();
+		DLroad.cleanup();
+
+		DScar.cleanup();
+		IBcars.cleanup();
+		DSenvironment.cleanup();
+		IBenvironment.cleanup();
+		DLenvironment.cleanup();
 	}
 
 	// Destroys Models, Texture and Descr Set Layouts
@@ -725,6 +793,8 @@ protected:
 		for (int i = 0; i < Menv.size(); i++) {
 			Menv[i].cleanup();
 		}
+		GPmesh.cleanup();
+		GPinstanced.cleanup();
 
 		//Descriptor Set Layouts Cleanup
 		DSLGlobal.cleanup();
@@ -755,46 +825,30 @@ protected:
 		//Draw Car
 		Pcar.bind(commandBuffer);
 		DSGlobal.bind(commandBuffer, Pcar, 0, currentImage);
-		for (int i = 0; i < Mcar.size(); i++) {
-			DScar[i].bind(commandBuffer, Pcar, 1, currentImage);
-			Mcar[i].bind(commandBuffer);
-			vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(Mcar[i].indices.size()), 1, 0, 0, 0);
+		DScar.bind(commandBuffer, Pcar, 1, currentImage);
+		GPinstanced.bind(commandBuffer);
+		IBcars.bind(commandBuffer, currentImage);
+		for (int k = 0; k < Mcar.size(); k++) {
+			// One instanced draw for all the cars of a model
+			vkCmdDrawIndexed(commandBuffer, Mcar[k].indexCount, carModelCount[k], Mcar[k].firstIndex, Mcar[k].vertexOffset, carModelFirst[k]);
 		}
 
-		//Draw Road pieces
+		//Draw Road pieces, tiles and Checkpoints: one indirect draw, every model from its first instance in the road table
 		Proad.bind(commandBuffer);
 		DSGlobal.bind(commandBuffer, Proad, 0, currentImage); 
-
-		MstraightRoad.bind(commandBuffer);
-		DSstraightRoad.bind(commandBuffer, Proad, 1, currentImage);
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(MstraightRoad.indices.size()), static_cast<uint32_t>(mapIndexes[STRAIGHT].size()), 0, 0, 0);
-
-		MturnLeft.bind(commandBuffer);
-		DSturnLeft.bind(commandBuffer, Proad, 1, currentImage);
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(MturnLeft.indices.size()), static_cast<uint32_t>(mapIndexes[LEFT].size()), 0, 0, 0);
-
-		MturnRight.bind(commandBuffer);
-		DSturnRight.bind(commandBuffer, Proad, 1, currentImage);
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(MturnRight.indices.size()), static_cast<uint32_t>(mapIndexes[RIGHT].size()), 0, 0, 0);
-
-		Mtile.bind(commandBuffer);
-		DStile.bind(commandBuffer, Proad, 1, currentImage);
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(Mtile.indices.size()), static_cast<uint32_t>(mapIndexes[NONE].size()), 0, 0, 0);
-
-		//Draw Checkpoints
-		Mcp.bind(commandBuffer);
-		DScp.bind(commandBuffer, Proad, 1, currentImage);
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(Mcp.indices.size()), static_cast<uint32_t>(checkpoints.size() * 2), 0, 0, 0);
+		DSroad.bind(commandBuffer, Proad, 1, currentImage);
+		GPmesh.bind(commandBuffer);
+		IBroadVisible.bind(commandBuffer, currentImage);
+		DLroad.draw(commandBuffer, currentImage);
 
 		//Draw Environment
 		//extract number, count uniqueness (map) and i = id, menv.size() = uniqueness
 		Penv.bind(commandBuffer);
-		for (int i = 0; i < Menv.size(); i++) {
-			Menv[i].bind(commandBuffer);
-			DSGlobal.bind(commandBuffer, Penv, 0, currentImage);
-			DSenvironment[i].bind(commandBuffer, Penv, 1, currentImage);
-			vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(Menv[i].indices.size()), static_cast<uint32_t>(envIndexesPerModel[i].size()), 0, 0, 0);
-		}
+		DSGlobal.bind(commandBuffer, Penv, 0, currentImage);
+		DSenvironment.bind(commandBuffer, Penv, 1, currentImage);
+		GPinstanced.bind(commandBuffer);
+		IBenvironment.bind(commandBuffer, currentImage);
+		DLenvironment.draw(commandBuffer, currentImage);
 	}
 
 	// Updates the uniform buffer
@@ -811,518 +865,198 @@ protected:
 		pMat[1][1] *= -1;													//Flip Y
 		glm::mat4 vpMat;													//View Projection Matrix
 		
-		if (!raceIsEnded) {
-			CarsMotionHandler(deltaT, m);
-			CheckpointHandler(deltaT, m);
-
-		} else {
-			steeringAng[winner] += 15.0f * carSteeringSpeed * deltaT; 
+		// The race advances in fixed steps whatever the frame rate, the rendered car poses are interpolated
+		RaceInput input;
+		input.throttle = -m.z;
+		input.steer = m.x;
+		input.handbrake = isKeyPressed(GLFW_KEY_SPACE);
+		int simSteps = simClock.advance(deltaT);
+		for (int s = 0; s < simSteps; s++) {
+			SimulationStep(simClock.step, input);
 		}
+		InterpolateCarPoses(simClock.alpha());
+
 		//Walk model procedure 
 		dampedCamPos = CameraPositionHandler(r, deltaT, m, vpMat, pMat);
+		if (frustumCulling) {
+			CullStaticInstances(vpMat, currentImage);
+		}
 
 		// Scenery change and update
 		turningTime += deltaT;
 		turningTime = (turningTime >= 2.0 * sun_cycle_duration) ? 0.0f : turningTime;
 		if (turningTime > daily_phase_duration && scene == 0) {
 			scene = 1;
-			RebuildPipeline();
 		}
 		if (turningTime > 2.0f * daily_phase_duration && scene == 1) {
 			scene = 2;
-			RebuildPipeline();
 		}
 		if (turningTime > sun_cycle_duration && scene == 2) {
 			scene = 3;
-			RebuildPipeline();
 		}
 		if (turningTime <= daily_phase_duration && scene == 3) {
 			scene = 0;
-			RebuildPipeline();
 		}
 
 		//Global
-		GlobalUniformBufferObject* g_ubo = new GlobalUniformBufferObject();
-		if (scene != 3)
-			g_ubo->lightPos = glm::vec3(0.0f, sin(glm::radians(180.0f) - rad_per_sec * turningTime), cos(glm::radians(180.0f) - rad_per_sec * turningTime));
-		else
-			g_ubo->lightPos = glm::vec3(0.0f, sin(glm::radians(180.0f) - rad_per_sec * (turningTime - sun_cycle_duration)), cos(glm::radians(180.0f) - rad_per_sec * (turningTime - sun_cycle_duration)));
-
-		timeScene = turningTime - scene * daily_phase_duration;
-		timeFactor = timeScene / daily_phase_duration;
-
-		switch (scene) {
-		case 0: //from sunrise to day
-			startingColor = glm::vec3(sunriseColor);
-			finalColor = glm::vec3(dayColor);
-			break;
-		case 1: // from day to sunset
-			startingColor = glm::vec3(dayColor);
-			finalColor = glm::vec3(sunsetColor);
-			break;
-		case 2: //from sunset to night
-			startingColor = glm::vec3(sunsetColor);
-			finalColor = glm::vec3(0.0f, 0.0f, 0.0f);
-			break;
-		default: // night
-			startingColor = glm::vec3(moonColor);
-			finalColor = glm::vec3(moonColor);
-			break;
-		}
-		g_ubo->lightColor = glm::vec4(startingColor * (1 - timeFactor) + finalColor * timeFactor, 1.0f);
-		g_ubo->viewerPosition = dampedCamPos; //glm::vec3(glm::inverse(viewMatrix) * glm::vec4(0, 0, 0, 1)); // would dampedCam make sense?
-		DSGlobal.map(currentImage, g_ubo, 0);
-
-		//SkyBox
-		skyBoxUniformBufferObject* sb_ubo = new skyBoxUniformBufferObject();
-		sb_ubo->mvpMat = pMat * glm::mat4(glm::mat3(viewMatrix)); //Remove Translation part of ViewMatrix, take only Rotation part and applies Projection
-		DSSkyBox.map(currentImage, sb_ubo, 0);
-
-		//Player Car
-		CarUniformBufferObject* car_ubo = new CarUniformBufferObject();
-		for (int i = 0; i < NUM_CARS; i++) {
-			car_ubo->mMat = glm::translate(glm::mat4(1.0f), updatedCarPos[i]) *
-				glm::rotate(glm::mat4(1.0f), glm::radians(180.0f + initialRotation) + steeringAng[i], glm::vec3(0, 1, 0));
-			car_ubo->mvpMat = vpMat * car_ubo->mMat;
-			car_ubo->nMat = glm::inverse(glm::transpose(car_ubo->mMat));
-			DScar[i].map(currentImage, car_ubo, 0);
-		}
-		
-		CarLightsUniformBufferObject* carLights_ubo = new CarLightsUniformBufferObject();
-		for (int j = 0; j < NUM_CARS; j++){
-			glm::mat4 rotationMatrix = glm::rotate(glm::mat4(1.0f), steeringAng[j] + glm::radians(initialRotation), glm::vec3(0.0f, 1.0f, 0.0f));
-			for (int i = 0; i < 2; i++) {
-				glm::vec3 lightsOffset = glm::vec3((i == 0) ? -0.5f : 0.5f, 0.6f, -1.5f);
-				carLights_ubo->headlightPosition[j][i] = updatedCarPos[j] + glm::vec3(rotationMatrix * glm::vec4(lightsOffset, 1.0f));
-				carLights_ubo->headlightDirection[j][i] = glm::vec3(rotationMatrix * glm::vec4(0.0f, -0.2f, -1.0f, 0.0f)); //pointing forward
-				if (scene == 3) {
-					carLights_ubo->headlightColor[j][i] = glm::vec4(1.0f, 1.0f, 1.0f, 0.5f); //white
-				}
-				else {
-					carLights_ubo->headlightColor[j][i] = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
-				}
-				lightsOffset = glm::vec3((i == 0) ? -0.55f : 0.55f, 0.6f, 1.9f);
-				carLights_ubo->rearLightPosition[j][i] = updatedCarPos[j] + glm::vec3(rotationMatrix * glm::vec4(lightsOffset, 1.0f));
-				carLights_ubo->rearLightDirection[j][i] = glm::vec3(rotationMatrix * glm::vec4(0.0f, -0.2f, 1.0f, 0.0f)); //pointing backwards
-				if (scene == 3) {
-					carLights_ubo->rearLightColor[j][i] = glm::vec4(1.0f, 0.0f, 0.0f, 0.5f); //red
-				}
-				else {
-					carLights_ubo->rearLightColor[j][i] = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
-				}
-			}
-		}
-
-		//Road
-		RoadUniformBufferObject* straight_road_ubo = new RoadUniformBufferObject();
-		RoadLightsUniformBufferObject* lights_straight_road_ubo = new RoadLightsUniformBufferObject(); 
-		for (int i = 0; i < mapIndexes[STRAIGHT].size(); i++) {
-			int n = mapIndexes[STRAIGHT][i].first;
-			int m = mapIndexes[STRAIGHT][i].second;
-			straight_road_ubo->mMat[i] = glm::translate(glm::mat4(1.0f), mapLoaded[n][m].pos) *
-										 glm::rotate(glm::mat4(1.0f), glm::radians(mapLoaded[n][m].rotation + baseObjectRotation), glm::vec3(0, 1, 0));
-			straight_road_ubo->mvpMat[i] = vpMat * straight_road_ubo->mMat[i];
-			straight_road_ubo->nMat[i] = glm::inverse(glm::transpose(straight_road_ubo->mMat[i]));
-			
-			bool oneCondition = false;
-			bool m_oneCondition = false;
-			int directions[4][2] = { {-1, 0}, {1, 0}, {0, -1}, {0, 1} }; // Up, Down, Left, Right
-
-			for (int i = 0; i < 4; i++) {
-				int newN = n + directions[i][0];
-				int newM = m + directions[i][1];
-
-				// Check if the neighboring cell has type 1 or 2
-				if (mapLoaded[newN][newM].type == 1 || mapLoaded[newN][newM].type == 2) {
-					// Identify the condition based on the direction
-					if (directions[i][0] >= 0 && directions[i][1] >= 0) {
-						oneCondition = true;
-					} else if (directions[i][0] <= 0 && directions[i][1] <= 0) {
-						m_oneCondition = true;
-					}
-				}
+		{
+			PROFILE_ZONE("UBO Global");
+			if (scene != 3)
+				g_ubo.lightPos = glm::vec3(0.0f, sin(glm::radians(180.0f) - rad_per_sec * turningTime), cos(glm::radians(180.0f) - rad_per_sec * turningTime));
+			else
+				g_ubo.lightPos = glm::vec3(0.0f, sin(glm::radians(180.0f) - rad_per_sec * (turningTime - sun_cycle_duration)), cos(glm::radians(180.0f) - rad_per_sec * (turningTime - sun_cycle_duration)));
+
+			timeScene = turningTime - scene * daily_phase_duration;
+			timeFactor = timeScene / daily_phase_duration;
+
+			switch (scene) {
+			case 0: //from sunrise to day
+				startingColor = glm::vec3(sunriseColor);
+				finalColor = glm::vec3(dayColor);
+				break;
+			case 1: // from day to sunset
+				startingColor = glm::vec3(dayColor);
+				finalColor = glm::vec3(sunsetColor);
+				break;
+			case 2: //from sunset to night
+				startingColor = glm::vec3(sunsetColor);
+				finalColor = glm::vec3(0.0f, 0.0f, 0.0f);
+				break;
+			default: // night
+				startingColor = glm::vec3(moonColor);
+				finalColor = glm::vec3(moonColor);
+				break;
 			}
-
-			glm::mat4 rotation = glm::rotate(glm::mat4(1.0f), glm::radians(mapLoaded[n][m].rotation), glm::vec3(0, 1, 0));
-			glm::mat4 transform = glm::translate(glm::mat4(1.0f), mapLoaded[n][m].pos) * rotation;
-
-			// Spot positions //0 middle, 1 previous, 2 next (the one furthest from the model)
-			lights_straight_road_ubo->spotLight_lightPosition[i][0] = transform * glm::vec4(-4.9f, 4.9f, -0.2f, 1.0f);
-			lights_straight_road_ubo->spotLight_spotDirection[i][0] = rotation * glm::vec4(0.4f, -1.0f, 0.0f, 1.0f);
-			
-			if (!oneCondition) {
-				lights_straight_road_ubo->spotLight_lightPosition[i][1] = transform * glm::vec4(4.9f, 4.9f, 7.8f, 1.0f);
-				lights_straight_road_ubo->spotLight_spotDirection[i][1] = rotation * glm::vec4(-0.4f, -1.0f, 0.0f, 1.0f);
-			}
-
-			if (!m_oneCondition) {
-				lights_straight_road_ubo->spotLight_lightPosition[i][2] = transform * glm::vec4(4.9f, 4.9f, -7.8f, 1.0f);
-				lights_straight_road_ubo->spotLight_spotDirection[i][2] = rotation * glm::vec4(-0.4f, -1.0f, 0.0f, 1.0f);
-			} 
-		}
-		if (scene == 3) {
-			lights_straight_road_ubo->lightColorSpot = glm::vec4(1.0f, 1.0f, 0.5f, 1.0f);
-		}
-		else {
-			lights_straight_road_ubo->lightColorSpot = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
-		}
-		DSstraightRoad.map(currentImage, straight_road_ubo, 1);
-		DSstraightRoad.map(currentImage, carLights_ubo, 2);
-		DSstraightRoad.map(currentImage, lights_straight_road_ubo, 3);
-
-		//--------------------Turn Right
-		RoadUniformBufferObject* turn_right = new RoadUniformBufferObject();
-		RoadLightsUniformBufferObject* lights_turn_right_road_ubo = new RoadLightsUniformBufferObject();
-		for (int i = 0; i < mapIndexes[RIGHT].size(); i++) {
-			int n = mapIndexes[RIGHT][i].first;
-			int m = mapIndexes[RIGHT][i].second;
-			turn_right->mMat[i] = glm::translate(glm::mat4(1.0f), mapLoaded[n][m].pos) *
-								 glm::rotate(glm::mat4(1.0f), glm::radians(mapLoaded[n][m].rotation + baseObjectRotation), glm::vec3(0, 1, 0));
-			turn_right->mvpMat[i] = vpMat * turn_right->mMat[i];
-			turn_right->nMat[i] = glm::inverse(glm::transpose(turn_right->mMat[i]));		
-			
-			glm::mat4 rotation = glm::rotate(glm::mat4(1.0f), glm::radians(mapLoaded[n][m].rotation), glm::vec3(0, 1, 0));
-			glm::mat4 transform = glm::translate(glm::mat4(1.0f), mapLoaded[n][m].pos) * rotation;
-
-			// Spot positions
-			lights_turn_right_road_ubo->spotLight_lightPosition[i][0] = transform * glm::vec4(-4.85f, 4.9f, -5.9f, 1.0f);
-
-			// Spot directions
-			lights_turn_right_road_ubo->spotLight_spotDirection[i][0] = rotation * glm::vec4(0.4f, -1.0f, 0.4f, 1.0f);
-		}
-
-		if (scene == 3) {
-			lights_turn_right_road_ubo->lightColorSpot = glm::vec4(1.0f, 1.0f, 0.5f, 1.0f);
-		}
-		else {
-			lights_turn_right_road_ubo->lightColorSpot = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
-		}
-		DSturnRight.map(currentImage, turn_right, 1);
-		DSturnRight.map(currentImage, carLights_ubo, 2);
-		DSturnRight.map(currentImage, lights_turn_right_road_ubo, 3);
-
-		//--------------------Turn Left
-		RoadUniformBufferObject* turn_left = new RoadUniformBufferObject();
-		RoadLightsUniformBufferObject* lights_turn_left_road_ubo = new RoadLightsUniformBufferObject();
-		for (int i = 0; i < mapIndexes[LEFT].size(); i++) {
-			int n = mapIndexes[LEFT][i].first;
-			int m = mapIndexes[LEFT][i].second;
-			turn_left->mMat[i] = glm::translate(glm::mat4(1.0f), mapLoaded[n][m].pos) *
-								glm::rotate(glm::mat4(1.0f), glm::radians(mapLoaded[n][m].rotation + baseObjectRotation), glm::vec3(0, 1, 0));
-			turn_left->mvpMat[i] = vpMat * turn_left->mMat[i];
-			turn_left->nMat[i] = glm::inverse(glm::transpose(turn_left->mMat[i]));
-
-			glm::mat4 rotation = glm::rotate(glm::mat4(1.0f), glm::radians(mapLoaded[n][m].rotation - 90.0f), glm::vec3(0, 1, 0));
-			glm::mat4 transform = glm::translate(glm::mat4(1.0f), mapLoaded[n][m].pos) * rotation;
-
-			// Spot positions
-			lights_turn_left_road_ubo->spotLight_lightPosition[i][0] = transform * glm::vec4(-5.8f, 5.0f, 4.65f, 1.0f);
-
-			// Spot directions
-			lights_turn_left_road_ubo->spotLight_spotDirection[i][0] = rotation * glm::vec4(0.4f, -1.0f, -0.4f, 1.0f);
-		}
-
-		if (scene == 3) {
-			lights_turn_left_road_ubo->lightColorSpot = glm::vec4(1.0f, 1.0f, 0.5f, 1.0f);
-		}
-		else{
-			lights_turn_left_road_ubo->lightColorSpot = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
-		}
-		DSturnLeft.map(currentImage, turn_left, 1);
-		DSturnLeft.map(currentImage, carLights_ubo, 2);
-		DSturnLeft.map(currentImage, lights_turn_left_road_ubo, 3);
-
-		//--------------------Tile
-		RoadUniformBufferObject* r_tile = new RoadUniformBufferObject();
-		RoadLightsUniformBufferObject* lights_tile_ubo = new RoadLightsUniformBufferObject();
-		for (int i = 0; i < mapIndexes[NONE].size(); i++) {
-			int n = mapIndexes[NONE][i].first;
-			int m = mapIndexes[NONE][i].second;
-			r_tile->mMat[i] = glm::translate(glm::mat4(1.0f), mapLoaded[n][m].pos);
-			r_tile->mvpMat[i] = vpMat * r_tile->mMat[i];
-			r_tile->nMat[i] = glm::inverse(glm::transpose(r_tile->mMat[i]));
-			lights_tile_ubo->spotLight_lightPosition[i][0] = glm::vec4(0.0f);  
-			lights_tile_ubo->spotLight_spotDirection[i][0] = glm::vec4(0.0f);
-			lights_tile_ubo->spotLight_lightPosition[i][1] = glm::vec4(0.0f);
-			lights_tile_ubo->spotLight_spotDirection[i][1] = glm::vec4(0.0f);
-			lights_tile_ubo->spotLight_lightPosition[i][2] = glm::vec4(0.0f);
-			lights_tile_ubo->spotLight_spotDirection[i][2] = glm::vec4(0.0f);
+			g_ubo.lightColor = glm::vec4(startingColor * (1 - timeFactor) + finalColor * timeFactor, 1.0f);
+			g_ubo.vpMat = vpMat;
+			g_ubo.lightColorSpot = (scene == 3) ? glm::vec4(1.0f, 1.0f, 0.5f, 1.0f) : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+			g_ubo.viewerPosition = dampedCamPos; //glm::vec3(glm::inverse(viewMatrix) * glm::vec4(0, 0, 0, 1)); // would dampedCam make sense?
+			DSGlobal.map(currentImage, &g_ubo, 0);
 		}
-		lights_tile_ubo->lightColorSpot = glm::vec4(0.0f);
-		lights_tile_ubo->lightColorSpot = glm::vec4(0.0f);
-		DStile.map(currentImage, r_tile, 1);
-		DStile.map(currentImage, carLights_ubo, 2);
-		DStile.map(currentImage, lights_tile_ubo, 3);
-
-		// Checkpoints
-		RoadUniformBufferObject* cp_ubo = new RoadUniformBufferObject();
-		for (int i = 0, j = 0; i < checkpoints.size() * 2; i+=2, j++) {
-			cp_ubo->mMat[i] = glm::translate(glm::mat4(1.0f), checkpoints[j].pointA);
-			cp_ubo->mvpMat[i] = vpMat * cp_ubo->mMat[i];
-			cp_ubo->nMat[i] = glm::inverse(glm::transpose(cp_ubo->mMat[i]));
-
-			cp_ubo->mMat[i + 1] = glm::translate(glm::mat4(1.0f), checkpoints[j].pointB);
-			cp_ubo->mvpMat[i + 1] = vpMat * cp_ubo->mMat[i + 1];
-			cp_ubo->nMat[i + 1] = glm::inverse(glm::transpose(cp_ubo->mMat[i + 1]));
-		}
-		DScp.map(currentImage, cp_ubo, 1);
-		DScp.map(currentImage, carLights_ubo, 2);
-		DScp.map(currentImage, lights_tile_ubo, 3);
 
-		//Environment
-		EnvironmentUniformBufferObject env_ubo{};
-		for (int i = 0; i < DSenvironment.size(); i++) {
-			for (int j = 0; j < envIndexesPerModel[i].size(); j++) {
-				int n = envIndexesPerModel[i][j].first;
-				int m = envIndexesPerModel[i][j].second;
-				env_ubo.mMat[j] = glm::translate(glm::mat4(1.0f), mapLoaded[n][m].pos)*
-								  glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, +0.2f, 0.0f));;
-				env_ubo.mvpMat[j] = vpMat * env_ubo.mMat[j];
-				env_ubo.nMat[j] = glm::inverse(glm::transpose(env_ubo.mMat[j]));
-			}
-			DSenvironment[i].map(currentImage, &env_ubo, 0);
+		//SkyBox
+		{
+			PROFILE_ZONE("UBO SkyBox");
+			sb_ubo.mvpMat = pMat * glm::mat4(glm::mat3(viewMatrix)); //Remove Translation part of ViewMatrix, take only Rotation part and applies Projection
+			sb_ubo.phase = scene;
+			DSSkyBox.map(currentImage, &sb_ubo, 0);
 		}
-	}
 
-	// Handles checkpoint updates Checkpoint
-	void CheckpointHandler(float deltaT, glm::vec3 m) {
-		if (IsBetweenPoints(updatedCarPos[player_car], checkpoints[currentCheckpoint], deltaT, m)) {
-			currentCheckpoint++;
-			std::cout << "Lap: " << car_laps[player_car] << " Checkpoint: " << currentCheckpoint << std::endl;
-			if (currentCheckpoint == checkpoints.size()) {
-				currentCheckpoint = 0;
-				car_laps[player_car] += 1;
-				std::cout << "Lap: " << car_laps[player_car] << " Checkpoint: " << currentCheckpoint << std::endl;
-				if (maxLaps > 1) audio.PlayLapSound();
-			}
-			else {
-				audio.PlayCheckpointSound();
+		//Player Car
+		{
+			PROFILE_ZONE("UBO Cars");
+			char *instances = static_cast<char *>(IBcars.mapped(currentImage));
+			for (int i = 0; i < carCount; i++) {
+				int k = i % Mcar.size();
+				carInstances[i] = instances + (carModelFirst[k] + i / Mcar.size()) * sizeof(InstanceTransform);
 			}
+			InstanceMatrices::build(nullptr, renderCarPos.data(), renderSteeringAng.data(), glm::radians(180.0f + race.map.initialRotation),
+									carCount, carInstances.data());
 		}
 		
-		for (int i = 0; i < NUM_CARS; i++) {
-			if (i != player_car) {
-				if (intermediateCheckpointIsCrossed[i]) {
-					lapUpdatingHandler(i, deltaT);
+		//Car lights
+		{
+			PROFILE_ZONE("UBO CarLights");
+			// Only the cars nearest to the camera light the road, the fragment shader loops over a fixed number of them
+			int litCars[MAX_LIT_CARS];
+			int litCount = SelectLitCars(dampedCamPos, litCars);
+			for (int j = 0; j < MAX_LIT_CARS; j++){
+				if (j >= litCount) {
+					for (int i = 0; i < 2; i++) {
+						carLights_ubo.headlightColor[j][i] = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+						carLights_ubo.rearLightColor[j][i] = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+					}
+					continue;
 				}
-				else {
-					if (checkDistance(center_road_position, i, deltaT)) {
-						intermediateCheckpointIsCrossed[i] = true;
+				int c = litCars[j];
+				glm::mat4 rotationMatrix = glm::rotate(glm::mat4(1.0f), renderSteeringAng[c] + glm::radians(race.map.initialRotation), glm::vec3(0.0f, 1.0f, 0.0f));
+				for (int i = 0; i < 2; i++) {
+					glm::vec3 lightsOffset = glm::vec3((i == 0) ? -0.5f : 0.5f, 0.6f, -1.5f);
+					carLights_ubo.headlightPosition[j][i] = renderCarPos[c] + glm::vec3(rotationMatrix * glm::vec4(lightsOffset, 1.0f));
+					carLights_ubo.headlightDirection[j][i] = glm::vec3(rotationMatrix * glm::vec4(0.0f, -0.2f, -1.0f, 0.0f)); //pointing forward
+					if (scene == 3) {
+						carLights_ubo.headlightColor[j][i] = glm::vec4(1.0f, 1.0f, 1.0f, 0.5f); //white
+					}
+					else {
+						carLights_ubo.headlightColor[j][i] = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+					}
+					lightsOffset = glm::vec3((i == 0) ? -0.55f : 0.55f, 0.6f, 1.9f);
+					carLights_ubo.rearLightPosition[j][i] = renderCarPos[c] + glm::vec3(rotationMatrix * glm::vec4(lightsOffset, 1.0f));
+					carLights_ubo.rearLightDirection[j][i] = glm::vec3(rotationMatrix * glm::vec4(0.0f, -0.2f, 1.0f, 0.0f)); //pointing backwards
+					if (scene == 3) {
+						carLights_ubo.rearLightColor[j][i] = glm::vec4(1.0f, 0.0f, 0.0f, 0.5f); //red
+					}
+					else {
+						carLights_ubo.rearLightColor[j][i] = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
 					}
 				}
 			}
-			winnerHandler(i); 
-		}
-	}
-	
-	// Function to handle laps
-	void lapUpdatingHandler(int carIndex, float deltaT) {
-		if (checkDistance(checkpoints[checkpoints.size() - 1].position, carIndex, deltaT)) {
-			car_laps[carIndex]++;
-			intermediateCheckpointIsCrossed[carIndex] = false;
-		}
-	}
 
-	// Function to check if the car has won
-	void winnerHandler(int carIndex) {
-		if (car_laps[carIndex] == maxLaps) {
-			raceIsEnded = true;
-			winner = carIndex;
-			updatedCarPos[carIndex] = end_position;
-			audio.PlayClappingSound();
+			//Road, tiles and checkpoints: the instances are cached, only the car lights change
+			SBcarLights.map(currentImage, &carLights_ubo);
 		}
 	}
 
-	// Function to check if the car is crossing the checkpoint
-	bool IsBetweenPoints(const glm::vec3& carPos, const Checkpoint& checkpoint, float deltaT, glm::vec3 m) {
-		
-		bool isInRoad = false;
-		bool checkpointIsCrossed = false;
-		float epsilon = 0.0001f; 
-		float outOfRoadTollerance = 1.5f; 
-		float zToCross = checkpoint.pointA.z;
-		float xToCross = checkpoint.pointA.x; 
-
-		if (abs(checkpoint.pointA.z - checkpoint.pointB.z) < epsilon) { // MOVING ALONG Z
-			if (zToCross - oldUpdatedCarPos.z > 0.0f) { //POSITIVE Z AXES
-				checkpointIsCrossed = carPos.z >= zToCross;
-			}
-			else if (zToCross - oldUpdatedCarPos.z < 0.0f) { // NEGATIVE Z AXES
-				checkpointIsCrossed = carPos.z <= zToCross;
-			}
-			isInRoad = carPos.x <= glm::max(checkpoint.pointA.x, checkpoint.pointB.x) + outOfRoadTollerance && carPos.x >= glm::min(checkpoint.pointA.x, checkpoint.pointB.x) - outOfRoadTollerance;
-		}
-
-		else if (abs(checkpoint.pointA.x - checkpoint.pointB.x) < epsilon) { // MOVING ALONG X
-			if (xToCross - oldUpdatedCarPos.x > 0.0f) { // POSITIVE X AXES
-				checkpointIsCrossed = carPos.x >= xToCross;
-			}
-			else if (xToCross - oldUpdatedCarPos.x < 0.0f) { // NEGATIVE X AXES
-				checkpointIsCrossed = carPos.x <= xToCross;
-			}
-			isInRoad = carPos.z <= glm::max(checkpoint.pointA.z, checkpoint.pointB.z) + outOfRoadTollerance && carPos.z >= glm::min(checkpoint.pointA.z, checkpoint.pointB.z) - outOfRoadTollerance;
-		}
-		return isInRoad && checkpointIsCrossed;
-	}
-
-	//Defines the dynamics of the car movement and updates the car position
-	void CarsMotionHandler(float deltaT, glm::vec3& m)
-	{
-		bool handbrake = false;
-		if (glfwGetKey(window, GLFW_KEY_SPACE)) {
-			handbrake = true;
-			if (carVelocity[player_car] > 0) {
-				carVelocity[player_car] -= brakingStrength * 2 * deltaT;
-			}
-		}
-		(handbrake) ? carSteeringSpeed = glm::radians(90.0f) : carSteeringSpeed = glm::radians(60.0f);
-
-
-		// Handle acceleration/braking
-		if (m.z < 0) { // w pressed
-			if (carVelocity[player_car] >= 0) {
-				carVelocity[player_car] += carAcceleration * deltaT;
-				carVelocity[player_car] = glm::min(carVelocity[player_car], 70.0f);
-			}
-			else {
-				carVelocity[player_car] += brakingStrength * deltaT;
-			}
-		}
-		else if (m.z > 0) { // s pressed
-			if (carVelocity[player_car] > 0) { // car is moving forward, decelerate
-				carVelocity[player_car] -= brakingStrength * deltaT;
+	// Fills lit with the MAX_LIT_CARS cars nearest to viewer, nearest first, in one pass over the positions.
+	// Returns how many were found (fewer when the race has fewer cars)
+	int SelectLitCars(const glm::vec3 &viewer, int lit[MAX_LIT_CARS]) {
+		float litDistance[MAX_LIT_CARS];
+		int count = 0;
+		for (int i = 0; i < carCount; i++) {
+			glm::vec3 d = renderCarPos[i] - viewer;
+			float distance = glm::dot(d, d);
+			if (count < MAX_LIT_CARS) {
+				count++;
 			}
-			else { // car is moving backwards, accelerate in the opposite direction
-				m.x *= -1;
-				carVelocity[player_car] -= carAcceleration * deltaT;
-				carVelocity[player_car] = glm::max(carVelocity[player_car], -15.0f);
+			else if (distance >= litDistance[count - 1]) {
+				continue;
 			}
-		}
-		else { // no acceleration or deceleration
-			if (carVelocity[player_car] > 0.0f) {
-				carVelocity[player_car] -= friction * deltaT;
-				carVelocity[player_car] = glm::max(carVelocity[player_car], 0.0f);
-			}
-			else if (carVelocity[player_car] < 0.0f) {
-				m.x *= -1;
-				carVelocity[player_car] += friction * deltaT;
-				carVelocity[player_car] = glm::min(carVelocity[player_car], 0.0f);
-			}
-		}
-
-		// Handle steering
-		if (carVelocity[player_car] != 0.0f) {
-			steeringAng[player_car] += -m.x * carSteeringSpeed * deltaT;
-		}
-		
-		updateCarPosition(player_car, deltaT); 
-
-		//CollisionHandler(forwardDir[player_car], deltaT);
-		for (int i = 0; i < NUM_CARS; i++) {
-			if (i != player_car) {
-				if (nextAng[i] == 0.0f) {
-					manageCarDirection(i, deltaT);
-				}
-				else {
-					steeringAng[i] += nextAng[i];
-					nextAng[i] = 0.0f;
-				}
-				updatedCarPos[i] = updatedCarPos[i] * std::exp(-carDamping * deltaT) + startingCarPos[i] * (1 - std::exp(-carDamping * deltaT));
+			// Insertion in the sorted slots, the farthest one is dropped
+			int j = count - 1;
+			for (; j > 0 && litDistance[j - 1] > distance; j--) {
+				litDistance[j] = litDistance[j - 1];
+				lit[j] = lit[j - 1];
 			}
+			litDistance[j] = distance;
+			lit[j] = i;
 		}
+		return count;
 	}
 
-	// Collision detection and response
-	void CollisionHandler(glm::vec3& forwardDir, float deltaT)
-	{
-		float minBoundary = -SCALING_FACTOR * MAP_CENTER;
-		float maxBoundary = SCALING_FACTOR * MAP_CENTER ;
-		
-		glm::vec3 predictedPos = updatedCarPos[player_car] + forwardDir * carVelocity[player_car] * deltaT;
-		bool collided = false;
+	// Advances the cars and the race by one fixed step
+	void SimulationStep(float stepT, const RaceInput &input) {
+		PROFILE_ZONE("SimulationStep");
+		previousCarPos = race.state.cars.pos;
+		previousSteeringAng = race.state.cars.steeringAng;
 
-		if (predictedPos.x < minBoundary) {
-			predictedPos.x = minBoundary;
-			collided = true;
+		uint32_t events = race.step(input, stepT);
+		if (events & (RACE_EVENT_CHECKPOINT | RACE_EVENT_LAP)) {
+			std::cout << "Lap: " << race.state.cars.laps[player_car] << " Checkpoint: " << race.state.currentCheckpoint << std::endl;
 		}
-		else if (predictedPos.x > maxBoundary) {
-			predictedPos.x = maxBoundary;
-			collided = true;
-		}
-
-		if (predictedPos.z < minBoundary) {
-			predictedPos.z = minBoundary;
-			collided = true;
+		if (events & RACE_EVENT_LAP) {
+			if (race.map.laps > 1) audio.PlayLapSound();
 		}
-		else if (predictedPos.z > maxBoundary) {
-			predictedPos.z = maxBoundary;
-			collided = true;
+		else if (events & RACE_EVENT_CHECKPOINT) {
+			audio.PlayCheckpointSound();
 		}
-		
-		if (collided) {
-			carVelocity[player_car] *= -0.5f; 
-		}
-
-		// Apply the position update after collision response
-		updatedCarPos[player_car] = predictedPos;
-	}
-
-	// Manages the car direction and updates the car position
-	void manageCarDirection(int carIndex, float deltaT) {
-		int n, m, carLap;
-		carLap = car_laps[carIndex];
-
-		if(mapIndexes[LEFT].size() != 0 && nextLeftTurn[carIndex][carLap] != -1) {
-			n = mapIndexes[LEFT][nextLeftTurn[carIndex][carLap]].first; 
-			m = mapIndexes[LEFT][nextLeftTurn[carIndex][carLap]].second;
-			if (checkDistance(mapLoaded[n][m].pos, carIndex, deltaT)) {
-				nextAng[carIndex] = glm::radians(90.0f);
-				nextLeftTurn[carIndex][carLap] = ((nextLeftTurn[carIndex][carLap] < mapIndexes[LEFT].size() - 1) ? nextLeftTurn[carIndex][carLap] + 1 : -1);
-				startingCarPos[carIndex] = mapLoaded[n][m].pos;
-				return;
-			}
-		}
-		if(mapIndexes[RIGHT].size() != 0  && nextRightTurn[carIndex][carLap] != -1){
-			n = mapIndexes[RIGHT][nextRightTurn[carIndex][carLap]].first; 
-			m = mapIndexes[RIGHT][nextRightTurn[carIndex][carLap]].second;
-			if (checkDistance(mapLoaded[n][m].pos, carIndex, deltaT)) {
-				nextAng[carIndex] = -glm::radians(90.0f);
-
-				nextRightTurn[carIndex][carLap] = ((nextRightTurn[carIndex][carLap] < mapIndexes[RIGHT].size() - 1) ? nextRightTurn[carIndex][carLap] + 1 : -1);
-				startingCarPos[carIndex] = mapLoaded[n][m].pos;
-				return;
-			}
+		if (events & RACE_EVENT_FINISH) {
+			audio.PlayClappingSound();
 		}
-		carVelocity[carIndex] += carAcceleration * deltaT;
-		carVelocity[carIndex] = glm::min(carVelocity[carIndex], 70.0f - (25.0f * carIndex));
-		updateCarPosition(carIndex, deltaT); 
-		return; 
 	}
 
-	// Updates the car position based on the car velocity and steering angle
-	void updateCarPosition(int carIndex, float deltaT) {
-		forwardDir[carIndex].x = glm::sin(steeringAng[carIndex] + glm::radians(180.0f + initialRotation));
-		forwardDir[carIndex].y = 0.0f;
-		forwardDir[carIndex].z = glm::cos(steeringAng[carIndex] + glm::radians(180.0f + initialRotation));
-
-		startingCarPos[carIndex] += forwardDir[carIndex] * carVelocity[carIndex] * deltaT;
-		if (carIndex == player_car) {
-			oldUpdatedCarPos = updatedCarPos[carIndex];
+	// Car poses between the last two simulation steps, alpha is the fraction of step not simulated yet
+	void InterpolateCarPoses(float alpha) {
+		const RaceCars &cars = race.state.cars;
+		for (int i = 0; i < carCount; i++) {
+			renderCarPos[i] = glm::mix(previousCarPos[i], cars.pos[i], alpha);
+			renderSteeringAng[i] = glm::mix(previousSteeringAng[i], cars.steeringAng[i], alpha);
 		}
-		updatedCarPos[carIndex] = updatedCarPos[carIndex] * std::exp(-carDamping * deltaT) + startingCarPos[carIndex] * (1 - std::exp(-carDamping * deltaT));
-	}
-
-	// Checks if the car is close to the target position
-	bool checkDistance(glm::vec3 targetPos, int carIndex, float deltaT) {
-		float potVelocity = carVelocity[carIndex] + (2 * carAcceleration * deltaT); 
-		bool checkOnX = abs(updatedCarPos[carIndex].x - targetPos.x) <= abs(forwardDir[carIndex].x * potVelocity * deltaT) + abs(potVelocity * deltaT);
-		bool checkOnZ = abs(updatedCarPos[carIndex].z - targetPos.z) <= abs(forwardDir[carIndex].z * potVelocity * deltaT) + abs(potVelocity * deltaT);
-		return (checkOnX && checkOnZ);
 	}
 
 	//Handles the camera movement and updates the view matrix
 	glm::vec3 CameraPositionHandler(glm::vec3& r, float deltaT, glm::vec3& m, glm::mat4& vpMat, glm::mat4& pMat)
 	{
+		PROFILE_ZONE("CameraPositionHandler");
 		glm::vec3 dampedCamPos = camPos;
 		alpha += ROT_SPEED * r.y * deltaT;		// yaw, += for proper mouse movement
 		beta -= ROT_SPEED * r.x * deltaT;		// pitch
@@ -1331,34 +1065,34 @@ protected:
 		beta = (beta < 0.0f ? 0.0f : (beta > M_PI_2 - 0.4f ? M_PI_2 - 0.4f : beta));	// -0.3f to avoid camera flip for every camera distance
 		camDist = (camDist < 5.0f ? 5.0f : (camDist > 15.0f ? 15.0f : camDist));	    // Camera distance limits
 
-		if (!raceIsEnded) {
-			camPos = updatedCarPos[player_car] + glm::vec3(-glm::rotate(glm::mat4(1), alpha + steeringAng[player_car] + glm::radians(initialRotation), glm::vec3(0, 1, 0)) * //update camera position based on car position
+		if (!race.state.ended) {
+			camPos = renderCarPos[player_car] + glm::vec3(-glm::rotate(glm::mat4(1), alpha + renderSteeringAng[player_car] + glm::radians(race.map.initialRotation), glm::vec3(0, 1, 0)) * //update camera position based on car position
 				glm::rotate(glm::mat4(1), beta, glm::vec3(1, 0, 0)) *
 				glm::vec4(0, -camHeight, camDist, 1));
 		}
 		else {
 			float offset = 40.0f;
 
-			if (end_position.x > 0 && end_position.z > 0) {
-				camPos = glm::vec3(end_position.x + offset, offset - 15.0f, end_position.z + offset);
+			if (race.map.endPosition.x > 0 && race.map.endPosition.z > 0) {
+				camPos = glm::vec3(race.map.endPosition.x + offset, offset - 15.0f, race.map.endPosition.z + offset);
 			}
-			if (end_position.x > 0 && end_position.z < 0) {
-				camPos = glm::vec3(end_position.x + offset, offset - 15.0f, end_position.z - offset);
+			if (race.map.endPosition.x > 0 && race.map.endPosition.z < 0) {
+				camPos = glm::vec3(race.map.endPosition.x + offset, offset - 15.0f, race.map.endPosition.z - offset);
 			}
-			if (end_position.x < 0 && end_position.z > 0) {
-				camPos = glm::vec3(end_position.x - offset, offset - 15.0f, end_position.z + offset);
+			if (race.map.endPosition.x < 0 && race.map.endPosition.z > 0) {
+				camPos = glm::vec3(race.map.endPosition.x - offset, offset - 15.0f, race.map.endPosition.z + offset);
 			}
-			if (end_position.x < 0 && end_position.z < 0) {
-				camPos = glm::vec3(end_position.x - offset, offset - 15.0f, end_position.z - offset);
+			if (race.map.endPosition.x < 0 && race.map.endPosition.z < 0) {
+				camPos = glm::vec3(race.map.endPosition.x - offset, offset - 15.0f, race.map.endPosition.z - offset);
 			}
 		}
 		dampedCamPos = camPos * (1 - exp(-lambdaCam * deltaT)) + dampedCamPos * exp(-lambdaCam * deltaT); //apply camera damping
 
-		if (!raceIsEnded) {
-			viewMatrix = glm::lookAt(dampedCamPos, updatedCarPos[player_car], upVector);
+		if (!race.state.ended) {
+			viewMatrix = glm::lookAt(dampedCamPos, renderCarPos[player_car], upVector);
 		}
 		else {
-			viewMatrix = glm::lookAt(dampedCamPos, -end_position, upVector);
+			viewMatrix = glm::lookAt(dampedCamPos, -race.map.endPosition, upVector);
 		}
 		vpMat = pMat * viewMatrix;
 		return dampedCamPos; 
@@ -1370,7 +1104,114 @@ int main(int argc, char *argv[]) {
 	CG_PRJ app;
 
 	try {
+		uint64_t headlessFrames = 0, dumpInterval = 1;
+		bool headless = false;
+		std::string dumpDir, benchmarkScript, benchmarkReport = "benchmark.json";
+
+		// --profile [trace.json]: per-zone p50/p95/p99 report at exit, and a Chrome trace if a file is given
+		for (int i = 1; i < argc; i++) {
+			if (strcmp(argv[i], "--profile") == 0) {
+				bool hasFile = i + 1 < argc && argv[i + 1][0] != '-';
+				Profiler::start(hasFile ? argv[++i] : "");
+			}
+			// --headless [frames] [--dump-frames <dir> [--dump-interval <n>]]: offscreen rendering, no window.
+			// Without frames it runs until the benchmark ends
+			else if (strcmp(argv[i], "--headless") == 0) {
+				headless = true;
+				if (i + 1 < argc && argv[i + 1][0] != '-') {
+					headlessFrames = strtoull(argv[++i], nullptr, 10);
+				}
+			}
+			else if (strcmp(argv[i], "--dump-frames") == 0 && i + 1 < argc) {
+				dumpDir = argv[++i];
+			}
+			else if (strcmp(argv[i], "--dump-interval") == 0 && i + 1 < argc) {
+				dumpInterval = strtoull(argv[++i], nullptr, 10);
+			}
+			// --benchmark <script.json> [--benchmark-report <report.json>]: scripted input, fixed deltaT
+			else if (strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc) {
+				benchmarkScript = argv[++i];
+			}
+			else if (strcmp(argv[i], "--benchmark-report") == 0 && i + 1 < argc) {
+				benchmarkReport = argv[++i];
+			}
+			// --sim-rate <steps per second> [max steps per frame]: rate of the fixed-step simulation
+			else if (strcmp(argv[i], "--sim-rate") == 0 && i + 1 < argc) {
+				float rate = strtof(argv[++i], nullptr);
+				int maxSteps = (i + 1 < argc && argv[i + 1][0] != '-') ? atoi(argv[++i]) : 8;
+				if (rate <= 0.0f) {
+					throw std::runtime_error("--sim-rate needs a positive number of steps per second!");
+				}
+				app.setSimulationRate(rate, maxSteps);
+			}
+			// --matrix-bench [instances]: times the instance matrix kernel against glm, then exits
+			else if (strcmp(argv[i], "--matrix-bench") == 0) {
+				int count = (i + 1 < argc && argv[i + 1][0] != '-') ? atoi(argv[++i]) : 200;
+				InstanceMatrices::benchmark(std::max(count, 1), 1000);
+				return EXIT_SUCCESS;
+			}
+			// --loader-bench [iterations]: times the vertex packing of the models/ tree against the per-vertex loop, then exits
+			else if (strcmp(argv[i], "--loader-bench") == 0) {
+				int iterations = (i + 1 < argc && argv[i + 1][0] != '-') ? atoi(argv[++i]) : 20;
+				VertexDescriptor VD;
+				VD.init(nullptr, {
+					{ 0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX }
+				}, {
+					{ 0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, pos), sizeof(glm::vec3), POSITION },
+					{ 0, 1, VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, uv), sizeof(glm::vec2), UV },
+					{ 0, 2, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, normal), sizeof(glm::vec3), NORMAL }
+				});
+				Model::benchmarkLoaders(&VD, "models", std::max(iterations, 1));
+				return EXIT_SUCCESS;
+			}
+			// --cars <n>: cars in the race, the player included
+			else if (strcmp(argv[i], "--cars") == 0 && i + 1 < argc) {
+				int cars = atoi(argv[++i]);
+				if (cars < 1) {
+					throw std::runtime_error("--cars needs at least one car!");
+				}
+				app.setCarCount(cars);
+			}
+			// --no-culling: draws every road and environment instance, command buffers recorded once
+			else if (strcmp(argv[i], "--no-culling") == 0) {
+				app.setFrustumCulling(false);
+			}
+			// --load-threads <n>: threads decoding the models and textures at startup (default: one per core)
+			else if (strcmp(argv[i], "--load-threads") == 0 && i + 1 < argc) {
+				int threads = atoi(argv[++i]);
+				if (threads < 1) {
+					throw std::runtime_error("--load-threads needs at least one thread!");
+				}
+				app.setLoadThreads(threads);
+			}
+			// --no-mesh-cache: parses every model from its source, without reading or writing cache/meshes
+			else if (strcmp(argv[i], "--no-mesh-cache") == 0) {
+				app.setMeshCacheDir("");
+			}
+			// --asset-pack <file>: the pack built by AssetPacker.py, assets.pack by default. --no-asset-pack reads the loose files
+			else if (strcmp(argv[i], "--asset-pack") == 0 && i + 1 < argc) {
+				app.setAssetPack(argv[++i]);
+			}
+			else if (strcmp(argv[i], "--no-asset-pack") == 0) {
+				app.setAssetPack("");
+			}
+			// --record-input <script.json>: saves the played input as a benchmark script
+			else if (strcmp(argv[i], "--record-input") == 0 && i + 1 < argc) {
+				app.setInputRecording(argv[++i]);
+			}
+		}
+		if (!benchmarkScript.empty()) {
+			app.setBenchmark(benchmarkScript, benchmarkReport);
+		}
+		if (headless) {
+			if (headlessFrames == 0 && benchmarkScript.empty()) {
+				throw std::runtime_error("--headless needs a number of frames or a benchmark script!");
+			}
+			app.setHeadless(headlessFrames, dumpDir, dumpInterval);
+		}
+
 		app.run();
+		Profiler::stop();
 	}
 	catch (const std::exception& e) {
 		std::cerr << e.what() << std::endl;
@@ -38,20 +38,30 @@ public:
 		SDL_Quit();
 	}
 
+	// Decoded from the asset pack, or the loose file (readAsset, from Starter.hpp)
+	Mix_Chunk* LoadSound(const std::string& file) {
+		try {
+			Asset wav = readAsset(file);
+			return Mix_LoadWAV_RW(SDL_RWFromConstMem(wav.data(), (int)wav.size()), 1);
+		} catch (const std::exception&) {
+			return nullptr;
+		}
+	}
+
 	bool LoadSounds() {
-		checkpointSound = Mix_LoadWAV("audio/checkpoint.wav");
+		checkpointSound = LoadSound("audio/checkpoint.wav");
 		if (!checkpointSound) {
 			std::cerr << "Failed to load checkpoint sound" << std::endl;
 			return false;
 		}
-		lapSound = Mix_LoadWAV("audio/lap.wav");
-		if (!checkpointSound) {
-			std::cerr << "Failed to load checkpoint sound" << std::endl;
+		lapSound = LoadSound("audio/lap.wav");
+		if (!lapSound) {
+			std::cerr << "Failed to load lap sound" << std::endl;
 			return false;
 		}
-		clappingSound = Mix_LoadWAV("audio/clapping.wav");
-		if (!checkpointSound) {
-			std::cerr << "Failed to load checkpoint sound" << std::endl;
+		clappingSound = LoadSound("audio/clapping.wav");
+		if (!clappingSound) {
+			std::cerr << "Failed to load clapping sound" << std::endl;
 			return false;
 		}
 		return true;
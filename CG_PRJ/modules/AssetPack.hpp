@@ -0,0 +1,246 @@
+// Asset pack: the files of models/, textures/, shaders/, audio/ and config/ in a single file, built by
+// AssetPacker.py. It holds a header, an index of entries sorted by path, the paths, and the contents,
+// each aligned to header.alignment. The pack is mapped once at startup and a lookup returns a view into the
+// mapping, so an asset is never copied before its decoder reads it.
+// readAsset() resolves a relative path ("textures/...") through the pack, and falls back to the loose file
+// when there is no pack or the path is not in it.
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <streambuf>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct AssetPackHeader {
+	char magic[4];			// "MGPK"
+	uint32_t version;
+	uint32_t count;
+	uint32_t alignment;
+	uint64_t indexOffset;	// count AssetPackEntry
+	uint64_t namesOffset;
+};
+
+struct AssetPackEntry {
+	uint64_t offset;		// of the contents, from the start of the pack
+	uint64_t size;
+	uint32_t nameOffset;	// from namesOffset, not null terminated
+	uint32_t nameSize;
+};
+
+// Contents of an asset: a view into the pack, or the loose file read into memory
+struct Asset {
+	const char *view = nullptr;
+	size_t viewSize = 0;
+	std::vector<char> loose;
+
+	const char *data() const {
+		return view ? view : loose.data();
+	}
+	size_t size() const {
+		return view ? viewSize : loose.size();
+	}
+};
+
+// Read-only stream over an asset, for the loaders that parse from a std::istream
+struct AssetStreamBuf : std::streambuf {
+	AssetStreamBuf(const Asset &asset) {
+		char *p = const_cast<char *>(asset.data());
+		setg(p, p, p + asset.size());
+	}
+};
+
+class AssetPack {
+public:
+	static const uint32_t version = 1;
+
+	~AssetPack() {
+		close();
+	}
+
+	// False if the file is missing or is not a pack
+	bool open(const std::string &file) {
+		close();
+		if (!map(file)) {
+			return false;
+		}
+		if (!validate()) {
+			std::cout << "Not an asset pack: " << file << "\n";
+			close();
+			return false;
+		}
+		const AssetPackHeader *H = reinterpret_cast<const AssetPackHeader *>(base);
+		entries = reinterpret_cast<const AssetPackEntry *>(base + H->indexOffset);
+		names = base + H->namesOffset;
+		count = H->count;
+		std::cout << "Asset pack " << file << ": " << count << " files, " << size / 1024 << " KB mapped\n";
+		return true;
+	}
+
+	void close() {
+		if (base) {
+#ifdef _WIN32
+			UnmapViewOfFile(base);
+#else
+			munmap(const_cast<char *>(base), size);
+#endif
+		}
+		base = nullptr;
+		size = 0;
+		entries = nullptr;
+		names = nullptr;
+		count = 0;
+	}
+
+	bool isOpen() const {
+		return base != nullptr;
+	}
+
+	// Binary search of the sorted index, safe from any thread once the pack is open
+	bool find(const std::string &path, const char *&data, size_t &dataSize) const {
+		std::string key = normalize(path);
+		uint32_t lo = 0, hi = count;
+		while (lo < hi) {
+			uint32_t mid = (lo + hi) / 2;
+			const AssetPackEntry &E = entries[mid];
+			int c = key.compare(0, std::string::npos, names + E.nameOffset, E.nameSize);
+			if (c == 0) {
+				data = base + E.offset;
+				dataSize = E.size;
+				return true;
+			}
+			if (c < 0) {
+				hi = mid;
+			} else {
+				lo = mid + 1;
+			}
+		}
+		return false;
+	}
+
+private:
+	const char *base = nullptr;
+	size_t size = 0;
+	const AssetPackEntry *entries = nullptr;
+	const char *names = nullptr;
+	uint32_t count = 0;
+
+	// Every range of the header and of the entries must lie in the mapping, find() reads them unchecked
+	bool validate() const {
+		if (size < sizeof(AssetPackHeader)) {
+			return false;
+		}
+		const AssetPackHeader *H = reinterpret_cast<const AssetPackHeader *>(base);
+		if (memcmp(H->magic, "MGPK", 4) != 0 || H->version != version || H->indexOffset > size ||
+			uint64_t(H->count) * sizeof(AssetPackEntry) > size - H->indexOffset || H->namesOffset > size) {
+			return false;
+		}
+		const AssetPackEntry *E = reinterpret_cast<const AssetPackEntry *>(base + H->indexOffset);
+		uint64_t namesSize = size - H->namesOffset;
+		for (uint32_t i = 0; i < H->count; i++) {
+			if (E[i].offset > size || E[i].size > size - E[i].offset ||
+				uint64_t(E[i].nameOffset) + E[i].nameSize > namesSize) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// The pack stores paths relative to the game folder, with forward slashes
+	static std::string normalize(const std::string &path) {
+		std::string key = path;
+		std::replace(key.begin(), key.end(), '\\', '/');
+		while (key.compare(0, 2, "./") == 0) {
+			key.erase(0, 2);
+		}
+		return key;
+	}
+
+	bool map(const std::string &file) {
+#ifdef _WIN32
+		HANDLE f = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+							   FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (f == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		LARGE_INTEGER fileSize;
+		HANDLE mapping = nullptr;
+		if (GetFileSizeEx(f, &fileSize) && fileSize.QuadPart > 0) {
+			mapping = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		}
+		CloseHandle(f);
+		if (!mapping) {
+			return false;
+		}
+		base = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		CloseHandle(mapping);
+		size = base ? size_t(fileSize.QuadPart) : 0;
+		return base != nullptr;
+#else
+		int fd = ::open(file.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat st;
+		void *p = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		}
+		::close(fd);
+		if (p == MAP_FAILED) {
+			return false;
+		}
+		base = static_cast<const char *>(p);
+		size = st.st_size;
+		return true;
+#endif
+	}
+};
+
+inline AssetPack &assetPack() {
+	static AssetPack pack;
+	return pack;
+}
+
+Asset readAsset(const std::string &filename) {
+	Asset asset;
+	if (assetPack().isOpen() && assetPack().find(filename, asset.view, asset.viewSize)) {
+		return asset;
+	}
+
+	std::ifstream file(filename, std::ios::ate | std::ios::binary);
+	if (!file.is_open()) {
+		std::cout << "Failed to open: " << filename << "\n";
+		throw std::runtime_error("failed to open file!");
+	}
+	size_t fileSize = (size_t) file.tellg();
+	asset.loose.resize(fileSize);
+	file.seekg(0);
+	file.read(asset.loose.data(), fileSize);
+	return asset;
+}
+
+// Size of an asset without reading it, 0 if it does not exist
+uintmax_t assetSize(const std::string &filename) {
+	const char *data;
+	size_t size;
+	if (assetPack().isOpen() && assetPack().find(filename, data, size)) {
+		return size;
+	}
+	std::ifstream file(filename, std::ios::ate | std::ios::binary);
+	return file.is_open() ? (uintmax_t) file.tellg() : 0;
+}
@@ -0,0 +1,197 @@
+// Scripted benchmark: a recorded or hand written input stream replaces the keyboard, and a fixed
+// deltaT replaces the wall clock, so that every run of the same script simulates the same race.
+// The CPU and GPU time of every frame after the warm-up are collected, and written as a JSON report.
+//
+// Script format:
+// {
+//   "map": "config/map_ina.json",	(optional, map to race on)
+//   "seed": 1,					(optional, seed of the random placement of the environment)
+//   "frames": 3600,
+//   "warmUpFrames": 120,
+//   "deltaT": 0.0166667,
+//   "inputs": [ {"frame": 0, "m": [0, 0, -1], "r": [0, 0, 0], "fire": false}, ... ]
+// }
+// An input holds from its frame until the frame of the next one.
+
+struct BenchmarkInput {
+	glm::vec3 m = glm::vec3(0.0f);
+	glm::vec3 r = glm::vec3(0.0f);
+	bool fire = false;
+};
+
+struct BenchmarkKey {
+	uint64_t frame;
+	BenchmarkInput input;
+};
+
+struct BenchmarkStats {
+	size_t samples = 0;
+	float avg = 0.0f, p50 = 0.0f, p95 = 0.0f, p99 = 0.0f, max = 0.0f;
+};
+
+class Benchmark {
+public:
+	std::string scriptPath;
+	std::string map;
+	uint32_t seed = 1;
+	uint64_t frames = 0;
+	uint64_t warmUpFrames = 0;
+	float deltaT = 1.0f / 60.0f;
+	std::vector<BenchmarkKey> keys;
+
+	// ms, one sample per frame after the warm-up
+	std::vector<float> cpuFrameMs;
+	std::vector<float> gpuFrameMs;
+
+	void load(const std::string &file) {
+		std::ifstream in(file);
+		if (!in.is_open()) {
+			std::cout << "Failed to open: " << file << "\n";
+			throw std::runtime_error("failed to open benchmark script!");
+		}
+		nlohmann::json js;
+		in >> js;
+
+		scriptPath = file;
+		map = js.value("map", "");
+		seed = js.value("seed", 1u);
+		frames = js.value("frames", (uint64_t)0);
+		warmUpFrames = js.value("warmUpFrames", (uint64_t)0);
+		deltaT = js.value("deltaT", 1.0f / 60.0f);
+		if (frames == 0 || deltaT <= 0.0f) {
+			throw std::runtime_error("benchmark script needs frames > 0 and deltaT > 0!");
+		}
+
+		keys.clear();
+		for (const auto &k : js["inputs"]) {
+			BenchmarkKey K;
+			K.frame = k.value("frame", (uint64_t)0);
+			if (k.contains("m")) K.input.m = glm::vec3(k["m"][0], k["m"][1], k["m"][2]);
+			if (k.contains("r")) K.input.r = glm::vec3(k["r"][0], k["r"][1], k["r"][2]);
+			K.input.fire = k.value("fire", false);
+			keys.push_back(K);
+		}
+		std::stable_sort(keys.begin(), keys.end(),
+						 [](const BenchmarkKey &a, const BenchmarkKey &b) { return a.frame < b.frame; });
+
+		// Sampling never grows the vectors inside the frame loop
+		cpuFrameMs.reserve(frames);
+		gpuFrameMs.reserve(frames);
+	}
+
+	BenchmarkInput input(uint64_t frame) const {
+		auto it = std::upper_bound(keys.begin(), keys.end(), frame,
+								   [](uint64_t f, const BenchmarkKey &k) { return f < k.frame; });
+		return it == keys.begin() ? BenchmarkInput() : (it - 1)->input;
+	}
+
+	void addCpuFrame(uint64_t frame, float ms) {
+		if (frame >= warmUpFrames) {
+			cpuFrameMs.push_back(ms);
+		}
+	}
+
+	void addGpuFrame(uint64_t frame, float ms) {
+		if (frame >= warmUpFrames) {
+			gpuFrameMs.push_back(ms);
+		}
+	}
+
+	static BenchmarkStats stats(std::vector<float> v) {
+		BenchmarkStats S;
+		S.samples = v.size();
+		if (v.empty()) {
+			return S;
+		}
+		std::sort(v.begin(), v.end());
+		double total = 0.0;
+		for (float x : v) {
+			total += x;
+		}
+		auto percentile = [&v](float p) {
+			return v[std::min(v.size() - 1, static_cast<size_t>(p / 100.0f * v.size()))];
+		};
+		S.avg = static_cast<float>(total / v.size());
+		S.p50 = percentile(50.0f);
+		S.p95 = percentile(95.0f);
+		S.p99 = percentile(99.0f);
+		S.max = v.back();
+		return S;
+	}
+
+	void writeReport(const std::string &file, bool gpuTimestamps) const {
+		auto statsJson = [](const BenchmarkStats &S) {
+			return nlohmann::json{{"samples", S.samples}, {"avg", S.avg}, {"p50", S.p50},
+								  {"p95", S.p95}, {"p99", S.p99}, {"max", S.max}};
+		};
+		BenchmarkStats cpu = stats(cpuFrameMs);
+		BenchmarkStats gpu = stats(gpuFrameMs);
+
+		nlohmann::json report;
+		report["script"] = scriptPath;
+		report["map"] = map;
+		report["frames"] = frames;
+		report["warmUpFrames"] = warmUpFrames;
+		report["deltaT"] = deltaT;
+		report["cpuFrameMs"] = statsJson(cpu);
+		report["gpuFrameMs"] = gpuTimestamps ? statsJson(gpu) : nlohmann::json();
+
+		std::ofstream out(file, std::ios::out | std::ios::trunc);
+		if (!out.is_open()) {
+			std::cout << "Failed to open: " << file << "\n";
+			throw std::runtime_error("failed to write benchmark report!");
+		}
+		out << report.dump(4) << "\n";
+
+		std::cout << "Benchmark (ms)   avg " << cpu.avg << "  p50 " << cpu.p50 << "  p95 " << cpu.p95
+				  << "  p99 " << cpu.p99 << "  max " << cpu.max << " (CPU frame)\n";
+		if (gpuTimestamps) {
+			std::cout << "                 avg " << gpu.avg << "  p50 " << gpu.p50 << "  p95 " << gpu.p95
+					  << "  p99 " << gpu.p99 << "  max " << gpu.max << " (GPU frame)\n";
+		}
+		std::cout << "Benchmark report saved to " << file << "\n";
+	}
+};
+
+// Saves the live input of every frame in the script format above, so that a played race can be replayed
+class BenchmarkRecorder {
+public:
+	std::string path;
+	std::string map;	// set by the application when it loads the map
+	std::vector<BenchmarkKey> keys;
+	uint64_t frames = 0;
+	double totalDeltaT = 0.0;
+
+	void add(float deltaT, const glm::vec3 &m, const glm::vec3 &r, bool fire) {
+		// Only the changes are stored
+		if (keys.empty() || keys.back().input.m != m || keys.back().input.r != r ||
+			keys.back().input.fire != fire) {
+			keys.push_back({frames, {m, r, fire}});
+		}
+		frames++;
+		totalDeltaT += deltaT;
+	}
+
+	void save() const {
+		nlohmann::json js;
+		js["map"] = map;
+		js["frames"] = frames;
+		js["warmUpFrames"] = std::min<uint64_t>(frames / 10, 120);
+		js["deltaT"] = frames > 0 ? totalDeltaT / frames : 1.0 / 60.0;
+		js["inputs"] = nlohmann::json::array();
+		for (const BenchmarkKey &K : keys) {
+			js["inputs"].push_back({{"frame", K.frame},
+									{"m", {K.input.m.x, K.input.m.y, K.input.m.z}},
+									{"r", {K.input.r.x, K.input.r.y, K.input.r.z}},
+									{"fire", K.input.fire}});
+		}
+
+		std::ofstream out(path, std::ios::out | std::ios::trunc);
+		if (!out.is_open()) {
+			std::cout << "Failed to open: " << path << "\n";
+			throw std::runtime_error("failed to write input recording!");
+		}
+		out << js.dump(4) << "\n";
+		std::cout << "Input recording saved to " << path << " (" << frames << " frames)\n";
+	}
+};
@@ -0,0 +1,58 @@
+// View frustum culling against bounding spheres (xyz center, w radius, in world space).
+// The six planes are taken from the view projection matrix, for the [0, 1] depth range of Vulkan
+// (GLM_FORCE_DEPTH_ZERO_TO_ONE); a point p is inside a plane when dot(plane.xyz, p) + plane.w >= 0.
+
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+struct Frustum {
+	glm::vec4 planes[6];
+
+	void fromViewProjection(const glm::mat4 &vp) {
+		// Rows of the column-major matrix
+		glm::vec4 r0(vp[0][0], vp[1][0], vp[2][0], vp[3][0]);
+		glm::vec4 r1(vp[0][1], vp[1][1], vp[2][1], vp[3][1]);
+		glm::vec4 r2(vp[0][2], vp[1][2], vp[2][2], vp[3][2]);
+		glm::vec4 r3(vp[0][3], vp[1][3], vp[2][3], vp[3][3]);
+
+		planes[0] = r3 + r0;	// left
+		planes[1] = r3 - r0;	// right
+		planes[2] = r3 + r1;	// bottom (top, with the Y flip of the projection)
+		planes[3] = r3 - r1;	// top
+		planes[4] = r2;			// near
+		planes[5] = r3 - r2;	// far
+
+		// Normalized, so that the distance of a center can be compared with the radius
+		for (glm::vec4 &p : planes) {
+			p /= glm::length(glm::vec3(p));
+		}
+	}
+
+	bool sees(const glm::vec4 &sphere) const {
+		glm::vec3 center(sphere);
+		for (const glm::vec4 &p : planes) {
+			if (glm::dot(glm::vec3(p), center) + p.w < -sphere.w) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Writes to visible the indices in [first, first + count) of the spheres in the frustum, in order.
+	// Returns how many were written
+	uint32_t cull(const glm::vec4 *spheres, uint32_t first, uint32_t count, uint32_t *visible) const {
+		uint32_t n = 0;
+		for (uint32_t i = first; i < first + count; i++) {
+			if (sees(spheres[i])) {
+				visible[n++] = i;
+			}
+		}
+		return n;
+	}
+};
+
+// Bounding sphere of an instance placed by mMat, for a model sphere in model space (rigid transforms only)
+inline glm::vec4 transformSphere(const glm::mat4 &mMat, const glm::vec4 &sphere) {
+	return glm::vec4(glm::vec3(mMat * glm::vec4(glm::vec3(sphere), 1.0f)), sphere.w);
+}
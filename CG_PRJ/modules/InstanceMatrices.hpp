@@ -0,0 +1,263 @@
+// Batch kernel for the matrices of the instances placed by a position and a rotation around Y (yaw):
+//   mMat = translate(pos) * rotate(yaw + yawOffset, Y), nMat = inverse(transpose(mMat)), mvpMat = vpMat * mMat
+// The inputs are SoA arrays, the matrices are written in place (mapped uniform or storage memory) as
+// consecutive column-major mat4: [mvpMat] mMat nMat, the layout of the car and instance blocks.
+// The yaws are turned into sin/cos 8 (AVX2) or 4 (SSE2) at a time and the matrices are assembled a
+// column per register; other targets, or INSTANCE_MATRICES_SCALAR, use the same closed form with std::sin/cos.
+
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#if !defined(INSTANCE_MATRICES_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define INSTANCE_MATRICES_SSE2
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#define INSTANCE_MATRICES_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+class InstanceMatrices {
+public:
+	// Instance i is written at dst + i * stride. vpMat can be nullptr (no mvpMat), yaw too (no rotation)
+	static void build(const glm::mat4 *vpMat, const glm::vec3 *pos, const float *yaw, float yawOffset,
+					  int count, void *dst, size_t stride) {
+		char *base = static_cast<char *>(dst);
+		buildBatch(vpMat, pos, yaw, yawOffset, count,
+				   [base, stride](int i) { return reinterpret_cast<float *>(base + i * stride); });
+	}
+
+	// Instance i is written at dst[i], for blocks that are not evenly spaced (one uniform block per car)
+	static void build(const glm::mat4 *vpMat, const glm::vec3 *pos, const float *yaw, float yawOffset,
+					  int count, void *const *dst) {
+		buildBatch(vpMat, pos, yaw, yawOffset, count,
+				   [dst](int i) { return static_cast<float *>(dst[i]); });
+	}
+
+	static const char *path() {
+#if defined(INSTANCE_MATRICES_AVX2)
+		return "AVX2";
+#elif defined(INSTANCE_MATRICES_SSE2)
+		return "SSE2";
+#else
+		return "scalar";
+#endif
+	}
+
+	// Microbenchmark: the kernel against the glm code it replaces, on count random cars
+	static void benchmark(int count, int iterations) {
+		struct Block {
+			glm::mat4 mvpMat, mMat, nMat;
+		};
+		std::mt19937 gen(1);
+		std::uniform_real_distribution<float> coord(-100.0f, 100.0f), angle(-20.0f, 20.0f);
+		std::vector<glm::vec3> pos(count);
+		std::vector<float> yaw(count);
+		for (int i = 0; i < count; i++) {
+			pos[i] = glm::vec3(coord(gen), coord(gen) * 0.01f, coord(gen));
+			yaw[i] = angle(gen);
+		}
+		glm::mat4 vpMat = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 500.0f) *
+						  glm::lookAt(glm::vec3(10.0f, 5.0f, 10.0f), glm::vec3(0.0f), glm::vec3(0, 1, 0));
+		float yawOffset = glm::radians(180.0f);
+		std::vector<Block> reference(count), batch(count);
+
+		auto time = [iterations](auto &&run) {
+			auto start = std::chrono::steady_clock::now();
+			for (int k = 0; k < iterations; k++) {
+				run();
+			}
+			return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+		};
+		double glmNs = time([&]() {
+			for (int i = 0; i < count; i++) {
+				Block &B = reference[i];
+				B.mMat = glm::translate(glm::mat4(1.0f), pos[i]) * glm::rotate(glm::mat4(1.0f), yawOffset + yaw[i], glm::vec3(0, 1, 0));
+				B.mvpMat = vpMat * B.mMat;
+				B.nMat = glm::inverse(glm::transpose(B.mMat));
+			}
+		});
+		double batchNs = time([&]() {
+			build(&vpMat, pos.data(), yaw.data(), yawOffset, count, batch.data(), sizeof(Block));
+		});
+
+		float maxError = 0.0f;
+		for (int i = 0; i < count; i++) {
+			const float *a = &reference[i].mvpMat[0][0];
+			const float *b = &batch[i].mvpMat[0][0];
+			for (int k = 0; k < 48; k++) {
+				maxError = std::max(maxError, std::abs(a[k] - b[k]));
+			}
+		}
+		std::cout << "Instance matrices, " << count << " instances, " << iterations << " iterations (" << path() << ")\n";
+		std::cout << "  glm   : " << glmNs / 1000.0 << " us/batch, " << glmNs / count << " ns/instance\n";
+		std::cout << "  batch : " << batchNs / 1000.0 << " us/batch, " << batchNs / count << " ns/instance, "
+				  << glmNs / batchNs << "x\n";
+		std::cout << "  max abs difference: " << maxError << "\n";
+	}
+
+private:
+	template <class DstAt>
+	static void buildBatch(const glm::mat4 *vpMat, const glm::vec3 *pos, const float *yaw, float yawOffset,
+						   int count, DstAt dstAt) {
+		float s[8], c[8];
+		int i = 0;
+		if (yaw == nullptr) {
+			for (; i < count; i++) {
+				store(vpMat, pos[i], std::sin(yawOffset), std::cos(yawOffset), dstAt(i));
+			}
+			return;
+		}
+#if defined(INSTANCE_MATRICES_AVX2)
+		for (; i + 8 <= count; i += 8) {
+			__m256 sinV, cosV;
+			sincos8(_mm256_add_ps(_mm256_loadu_ps(yaw + i), _mm256_set1_ps(yawOffset)), sinV, cosV);
+			_mm256_storeu_ps(s, sinV);
+			_mm256_storeu_ps(c, cosV);
+			for (int l = 0; l < 8; l++) {
+				store(vpMat, pos[i + l], s[l], c[l], dstAt(i + l));
+			}
+		}
+#endif
+#if defined(INSTANCE_MATRICES_SSE2)
+		for (; i + 4 <= count; i += 4) {
+			__m128 sinV, cosV;
+			sincos4(_mm_add_ps(_mm_loadu_ps(yaw + i), _mm_set1_ps(yawOffset)), sinV, cosV);
+			_mm_storeu_ps(s, sinV);
+			_mm_storeu_ps(c, cosV);
+			for (int l = 0; l < 4; l++) {
+				store(vpMat, pos[i + l], s[l], c[l], dstAt(i + l));
+			}
+		}
+#endif
+		for (; i < count; i++) {
+			float a = yaw[i] + yawOffset;
+			store(vpMat, pos[i], std::sin(a), std::cos(a), dstAt(i));
+		}
+	}
+
+	// With R the rotation around Y and t the translation:
+	//   mMat = | c 0 s tx |    nMat = inverse(transpose(mMat)) = |  R          0 |
+	//          | 0 1 0 ty |                                     | -(R^T t)^T  1 |
+	//          |-s 0 c tz |
+	//   mvpMat columns: vp0 * c - vp2 * s, vp1, vp0 * s + vp2 * c, vp0 * tx + vp1 * ty + vp2 * tz + vp3
+	static void store(const glm::mat4 *vpMat, const glm::vec3 &t, float s, float c, float *out) {
+		float nx = -(c * t.x - s * t.z);
+		float nz = -(s * t.x + c * t.z);
+#if defined(INSTANCE_MATRICES_SSE2)
+		if (vpMat != nullptr) {
+			const float *vp = &(*vpMat)[0][0];
+			__m128 vp0 = _mm_loadu_ps(vp), vp1 = _mm_loadu_ps(vp + 4), vp2 = _mm_loadu_ps(vp + 8), vp3 = _mm_loadu_ps(vp + 12);
+			__m128 S = _mm_set1_ps(s), C = _mm_set1_ps(c);
+			_mm_storeu_ps(out, _mm_sub_ps(_mm_mul_ps(vp0, C), _mm_mul_ps(vp2, S)));
+			_mm_storeu_ps(out + 4, vp1);
+			_mm_storeu_ps(out + 8, _mm_add_ps(_mm_mul_ps(vp0, S), _mm_mul_ps(vp2, C)));
+			_mm_storeu_ps(out + 12, _mm_add_ps(_mm_add_ps(_mm_mul_ps(vp0, _mm_set1_ps(t.x)), _mm_mul_ps(vp1, _mm_set1_ps(t.y))),
+											   _mm_add_ps(_mm_mul_ps(vp2, _mm_set1_ps(t.z)), vp3)));
+			out += 16;
+		}
+		// _mm_set_ps takes the elements from the last to the first
+		_mm_storeu_ps(out, _mm_set_ps(0.0f, -s, 0.0f, c));
+		_mm_storeu_ps(out + 4, _mm_set_ps(0.0f, 0.0f, 1.0f, 0.0f));
+		_mm_storeu_ps(out + 8, _mm_set_ps(0.0f, c, 0.0f, s));
+		_mm_storeu_ps(out + 12, _mm_set_ps(1.0f, t.z, t.y, t.x));
+		_mm_storeu_ps(out + 16, _mm_set_ps(nx, -s, 0.0f, c));
+		_mm_storeu_ps(out + 20, _mm_set_ps(-t.y, 0.0f, 1.0f, 0.0f));
+		_mm_storeu_ps(out + 24, _mm_set_ps(nz, c, 0.0f, s));
+		_mm_storeu_ps(out + 28, _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f));
+#else
+		if (vpMat != nullptr) {
+			const glm::mat4 &vp = *vpMat;
+			glm::vec4 columns[4] = { vp[0] * c - vp[2] * s, vp[1], vp[0] * s + vp[2] * c,
+									 vp[0] * t.x + vp[1] * t.y + vp[2] * t.z + vp[3] };
+			std::copy(&columns[0][0], &columns[0][0] + 16, out);
+			out += 16;
+		}
+		const float mn[32] = { c, 0.0f, -s, 0.0f,	0.0f, 1.0f, 0.0f, 0.0f,		s, 0.0f, c, 0.0f,	t.x, t.y, t.z, 1.0f,
+							   c, 0.0f, -s, nx,		0.0f, 1.0f, 0.0f, -t.y,		s, 0.0f, c, nz,		0.0f, 0.0f, 0.0f, 1.0f };
+		std::copy(mn, mn + 32, out);
+#endif
+	}
+
+#if defined(INSTANCE_MATRICES_SSE2)
+	// sin and cos of 4 angles: reduction to [-pi/4, pi/4] and the minimax polynomials of Cephes sinf/cosf.
+	// Accurate to a few ulp for |x| < 8192
+	static void sincos4(__m128 x, __m128 &s, __m128 &c) {
+		const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32((int)0x80000000));
+		__m128 signSin = _mm_and_ps(x, signMask);
+		x = _mm_andnot_ps(signMask, x);
+
+		// Octant j of |x|, rounded up to even
+		__m128i j = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.27323954473516f)));	// 4 / pi
+		j = _mm_and_si128(_mm_add_epi32(j, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+		__m128 y = _mm_cvtepi32_ps(j);
+
+		signSin = _mm_xor_ps(signSin, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(j, _mm_set1_epi32(4)), 29)));
+		__m128 signCos = _mm_castsi128_ps(_mm_slli_epi32(_mm_andnot_si128(_mm_sub_epi32(j, _mm_set1_epi32(2)), _mm_set1_epi32(4)), 29));
+		__m128 sinPoly = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(j, _mm_set1_epi32(2)), _mm_setzero_si128()));
+
+		// x - j * pi / 4, with pi / 4 split in three parts to keep the precision
+		x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(0.78515625f)));
+		x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(2.4187564849853515625e-4f)));
+		x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(3.77489497744594108e-8f)));
+		__m128 z = _mm_mul_ps(x, x);
+
+		__m128 yc = _mm_set1_ps(2.443315711809948e-5f);
+		yc = _mm_add_ps(_mm_mul_ps(yc, z), _mm_set1_ps(-1.388731625493765e-3f));
+		yc = _mm_add_ps(_mm_mul_ps(yc, z), _mm_set1_ps(4.166664568298827e-2f));
+		yc = _mm_mul_ps(_mm_mul_ps(yc, z), z);
+		yc = _mm_add_ps(_mm_sub_ps(yc, _mm_mul_ps(z, _mm_set1_ps(0.5f))), _mm_set1_ps(1.0f));
+
+		__m128 ys = _mm_set1_ps(-1.9515295891e-4f);
+		ys = _mm_add_ps(_mm_mul_ps(ys, z), _mm_set1_ps(8.3321608736e-3f));
+		ys = _mm_add_ps(_mm_mul_ps(ys, z), _mm_set1_ps(-1.6666654611e-1f));
+		ys = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(ys, z), x), x);
+
+		s = _mm_xor_ps(_mm_or_ps(_mm_and_ps(sinPoly, ys), _mm_andnot_ps(sinPoly, yc)), signSin);
+		c = _mm_xor_ps(_mm_or_ps(_mm_and_ps(sinPoly, yc), _mm_andnot_ps(sinPoly, ys)), signCos);
+	}
+#endif
+
+#if defined(INSTANCE_MATRICES_AVX2)
+	// sincos4 on 8 angles
+	static void sincos8(__m256 x, __m256 &s, __m256 &c) {
+		const __m256 signMask = _mm256_castsi256_ps(_mm256_set1_epi32((int)0x80000000));
+		__m256 signSin = _mm256_and_ps(x, signMask);
+		x = _mm256_andnot_ps(signMask, x);
+
+		__m256i j = _mm256_cvttps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(1.27323954473516f)));
+		j = _mm256_and_si256(_mm256_add_epi32(j, _mm256_set1_epi32(1)), _mm256_set1_epi32(~1));
+		__m256 y = _mm256_cvtepi32_ps(j);
+
+		signSin = _mm256_xor_ps(signSin, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(j, _mm256_set1_epi32(4)), 29)));
+		__m256 signCos = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_andnot_si256(_mm256_sub_epi32(j, _mm256_set1_epi32(2)), _mm256_set1_epi32(4)), 29));
+		__m256 sinPoly = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(j, _mm256_set1_epi32(2)), _mm256_setzero_si256()));
+
+		x = _mm256_sub_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(0.78515625f)));
+		x = _mm256_sub_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(2.4187564849853515625e-4f)));
+		x = _mm256_sub_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(3.77489497744594108e-8f)));
+		__m256 z = _mm256_mul_ps(x, x);
+
+		__m256 yc = _mm256_set1_ps(2.443315711809948e-5f);
+		yc = _mm256_add_ps(_mm256_mul_ps(yc, z), _mm256_set1_ps(-1.388731625493765e-3f));
+		yc = _mm256_add_ps(_mm256_mul_ps(yc, z), _mm256_set1_ps(4.166664568298827e-2f));
+		yc = _mm256_mul_ps(_mm256_mul_ps(yc, z), z);
+		yc = _mm256_add_ps(_mm256_sub_ps(yc, _mm256_mul_ps(z, _mm256_set1_ps(0.5f))), _mm256_set1_ps(1.0f));
+
+		__m256 ys = _mm256_set1_ps(-1.9515295891e-4f);
+		ys = _mm256_add_ps(_mm256_mul_ps(ys, z), _mm256_set1_ps(8.3321608736e-3f));
+		ys = _mm256_add_ps(_mm256_mul_ps(ys, z), _mm256_set1_ps(-1.6666654611e-1f));
+		ys = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(ys, z), x), x);
+
+		s = _mm256_xor_ps(_mm256_blendv_ps(yc, ys, sinPoly), signSin);
+		c = _mm256_xor_ps(_mm256_blendv_ps(ys, yc, sinPoly), signCos);
+	}
+#endif
+};
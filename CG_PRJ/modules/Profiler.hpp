@@ -0,0 +1,234 @@
+// Lightweight CPU profiler: PROFILE_ZONE("name") measures the enclosing scope.
+// Zones are recorded in a ring owned by each thread and drained once per frame by Profiler::endFrame(),
+// which streams them to a Chrome trace_event JSON file (chrome://tracing, Perfetto) and feeds
+// a rolling window per zone used for the p50/p95/p99 report.
+// When the profiler is not started a zone costs one branch, define DISABLE_PROFILER to compile them out.
+
+#include <chrono>
+#include <mutex>
+#include <fstream>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+struct ProfileEvent {
+	const char *name;
+	uint64_t start;		// ns since Profiler::start()
+	uint64_t duration;	// ns
+};
+
+// Single producer (the owner thread), single consumer (Profiler::endFrame)
+struct ProfileThreadRing {
+	static const uint32_t capacity = 4096;
+	ProfileEvent events[capacity];
+	std::atomic<uint32_t> head{0};
+	std::atomic<uint32_t> tail{0};
+	std::atomic<uint32_t> dropped{0};
+	uint32_t tid = 0;
+};
+
+struct ProfileZoneStats {
+	static const uint32_t windowSize = 512;
+	const char *name = nullptr;
+	float samples[windowSize];	// ms, the last windowSize measurements
+	uint64_t count = 0;
+	double totalMs = 0.0;
+	float maxMs = 0.0f;
+};
+
+class Profiler {
+	static const int maxZones = 128;
+
+	inline static std::atomic<bool> active{false};
+	inline static std::chrono::steady_clock::time_point origin;
+	inline static std::mutex ringsMutex;
+	inline static std::vector<ProfileThreadRing *> rings;
+	inline static std::ofstream trace;
+	inline static bool firstTraceEvent = true;
+	inline static ProfileZoneStats zones[maxZones];
+	inline static int zoneCount = 0;
+	inline static uint64_t droppedEvents = 0;
+
+	static ProfileThreadRing *threadRing() {
+		thread_local ProfileThreadRing *ring = nullptr;
+		if (ring == nullptr) {
+			ring = new ProfileThreadRing();
+			std::lock_guard<std::mutex> lock(ringsMutex);
+			ring->tid = static_cast<uint32_t>(rings.size());
+			rings.push_back(ring);
+		}
+		return ring;
+	}
+
+	static ProfileZoneStats *zone(const char *name) {
+		for (int i = 0; i < zoneCount; i++) {
+			if (zones[i].name == name || strcmp(zones[i].name, name) == 0) {
+				return &zones[i];
+			}
+		}
+		if (zoneCount == maxZones) {
+			return nullptr;
+		}
+		zones[zoneCount].name = name;
+		return &zones[zoneCount++];
+	}
+
+	static void consume(const ProfileEvent &e, uint32_t tid) {
+		float ms = e.duration / 1.0e6f;
+		ProfileZoneStats *Z = zone(e.name);
+		if (Z != nullptr) {
+			Z->samples[Z->count % ProfileZoneStats::windowSize] = ms;
+			Z->count++;
+			Z->totalMs += ms;
+			Z->maxMs = std::max(Z->maxMs, ms);
+		}
+
+		if (trace.is_open()) {
+			trace << (firstTraceEvent ? "\n" : ",\n")
+				  << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << tid
+				  << ",\"ts\":" << e.start / 1000 << "." << std::setw(3) << std::setfill('0') << e.start % 1000
+				  << ",\"dur\":" << e.duration / 1000 << "." << std::setw(3) << std::setfill('0') << e.duration % 1000
+				  << "}";
+			firstTraceEvent = false;
+		}
+	}
+
+public:
+	static bool enabled() {
+		return active.load(std::memory_order_relaxed);
+	}
+
+	static uint64_t now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now() - origin).count();
+	}
+
+	// An empty tracePath only collects the statistics
+	static void start(const std::string &tracePath) {
+		origin = std::chrono::steady_clock::now();
+		if (!tracePath.empty()) {
+			trace.open(tracePath, std::ios::out | std::ios::trunc);
+			if (!trace.is_open()) {
+				std::cout << "Failed to open: " << tracePath << "\n";
+				throw std::runtime_error("failed to open profiler trace file!");
+			}
+			trace << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+			firstTraceEvent = true;
+		}
+		active.store(true, std::memory_order_relaxed);
+	}
+
+	static void stop() {
+		if (!enabled()) {
+			return;
+		}
+		endFrame();
+		active.store(false, std::memory_order_relaxed);
+		if (trace.is_open()) {
+			trace << "\n]}\n";
+			trace.close();
+		}
+		printReport();
+	}
+
+	static void record(const char *name, uint64_t start, uint64_t end) {
+		ProfileThreadRing *R = threadRing();
+		uint32_t head = R->head.load(std::memory_order_relaxed);
+		if (head - R->tail.load(std::memory_order_acquire) >= ProfileThreadRing::capacity) {
+			R->dropped.fetch_add(1, std::memory_order_relaxed);	// ring full: the event is lost
+			return;
+		}
+		R->events[head % ProfileThreadRing::capacity] = { name, start, end - start };
+		R->head.store(head + 1, std::memory_order_release);
+	}
+
+	// Drains the rings of every thread, to be called once per frame by the main loop
+	static void endFrame() {
+		if (!enabled()) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		for (ProfileThreadRing *R : rings) {
+			uint32_t head = R->head.load(std::memory_order_acquire);
+			uint32_t tail = R->tail.load(std::memory_order_relaxed);
+			droppedEvents += R->dropped.exchange(0, std::memory_order_relaxed);
+			for (; tail != head; tail++) {
+				consume(R->events[tail % ProfileThreadRing::capacity], R->tid);
+			}
+			R->tail.store(tail, std::memory_order_release);
+		}
+	}
+
+	// Percentile (0-100) in ms of the last samples of a zone, -1 if the zone was never recorded
+	static float percentile(const char *name, float p) {
+		for (int i = 0; i < zoneCount; i++) {
+			if (strcmp(zones[i].name, name) == 0) {
+				return percentile(zones[i], p);
+			}
+		}
+		return -1.0f;
+	}
+
+	static float percentile(const ProfileZoneStats &Z, float p) {
+		float window[ProfileZoneStats::windowSize];
+		uint32_t n = static_cast<uint32_t>(std::min<uint64_t>(Z.count, ProfileZoneStats::windowSize));
+		if (n == 0) {
+			return -1.0f;
+		}
+		std::copy(Z.samples, Z.samples + n, window);
+		uint32_t k = std::min(n - 1, static_cast<uint32_t>(p / 100.0f * n));
+		std::nth_element(window, window + k, window + n);
+		return window[k];
+	}
+
+	static void printReport() {
+		std::cout << "Profiler zones (ms, last " << ProfileZoneStats::windowSize << " samples):\n";
+		std::cout << std::left << std::setw(28) << "zone" << std::right
+				  << std::setw(10) << "count" << std::setw(10) << "avg"
+				  << std::setw(10) << "p50" << std::setw(10) << "p95"
+				  << std::setw(10) << "p99" << std::setw(10) << "max" << "\n";
+		std::cout << std::fixed << std::setprecision(3);
+		for (int i = 0; i < zoneCount; i++) {
+			const ProfileZoneStats &Z = zones[i];
+			std::cout << std::left << std::setw(28) << Z.name << std::right
+					  << std::setw(10) << Z.count
+					  << std::setw(10) << (Z.count > 0 ? Z.totalMs / Z.count : 0.0)
+					  << std::setw(10) << percentile(Z, 50.0f)
+					  << std::setw(10) << percentile(Z, 95.0f)
+					  << std::setw(10) << percentile(Z, 99.0f)
+					  << std::setw(10) << Z.maxMs << "\n";
+		}
+		std::cout << std::defaultfloat;
+		if (droppedEvents > 0) {
+			std::cout << "Profiler rings overflowed: " << droppedEvents << " zones were lost\n";
+		}
+	}
+};
+
+struct ProfileZone {
+	const char *name;
+	uint64_t start;
+
+	ProfileZone(const char *zoneName) {
+		name = Profiler::enabled() ? zoneName : nullptr;
+		start = name ? Profiler::now() : 0;
+	}
+
+	~ProfileZone() {
+		if (name) {
+			Profiler::record(name, start, Profiler::now());
+		}
+	}
+};
+
+#ifndef DISABLE_PROFILER
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#else
+#define PROFILE_ZONE(name)
+#endif
@@ -0,0 +1,570 @@
+// Race simulation, independent from the renderer, the window and the audio.
+// The world state is plain data, RaceSimulation::step() advances it by dt with the input of the player car
+// and returns what happened (checkpoints, laps, end of the race), so that the caller can play the sounds.
+// It only needs glm and nlohmann::json: it can be compiled on its own to run many races faster than
+// real time, while the game just renders RaceSimulation::state.
+
+#include <vector>
+#include <map>
+#include <string>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <json.hpp>
+
+#define DEFAULT_MAP_SIZE 11
+#define DIRECTIONS 4
+#define SCALING_FACTOR 16.0f
+
+//Road Types
+enum RoadType {
+	STRAIGHT = 0,
+	LEFT = 1,
+	RIGHT = 2,
+	NONE = 3
+};
+
+struct RoadPosition {
+	glm::vec3 pos;
+	int type;
+	float rotation;
+};
+
+struct Checkpoint {
+	glm::vec3 position;
+	glm::vec3 pointA;
+	glm::vec3 pointB;
+};
+
+// Track built from a map file of config/
+struct RaceMap {
+	int size = DEFAULT_MAP_SIZE;
+	int center = DEFAULT_MAP_SIZE / 2;
+	std::vector<std::vector<RoadPosition>> tiles;				// [row][col]
+	std::vector<std::vector<std::pair<int, int>>> indexes;		// tiles of each RoadType
+	std::map<int, Checkpoint> checkpoints;						// the last one is the finish line
+	std::vector<glm::vec3> roadsPosition;						// road pieces in track order, from the start
+	std::vector<RoadType> roadsType;
+	glm::vec3 startPosition = glm::vec3(0.0f);
+	glm::vec3 endPosition = glm::vec3(0.0f);
+	glm::vec3 centerRoadPosition = glm::vec3(0.0f);			// crossed by the bots halfway through a lap
+	float initialRotation = 0.0f;								// degrees, heading of the cars at the start
+	int laps = 20;
+	float checkpointOffset = 6.0f;
+};
+
+// Car table as a structure of arrays, indexed by car: the update loops walk each field linearly,
+// so that hundreds of cars stay in a few contiguous cache lines per field
+struct RaceCars {
+	std::vector<glm::vec3> targetPos;		// the position follows it with damping
+	std::vector<glm::vec3> pos;
+	std::vector<glm::vec3> forwardDir;
+	std::vector<float> velocity;
+	std::vector<float> topSpeed;
+	std::vector<float> steeringAng;			// heading, relative to RaceMap::initialRotation
+	std::vector<float> nextAng;				// turn of a bot, applied at the next step
+	std::vector<int> laps;					// -1 for the bots that start before the finish line
+	// Bots only: middle of the track crossed in this lap, and next turn of the lap to take in
+	// RaceMap::indexes[LEFT / RIGHT] (-1 when there are no more)
+	std::vector<uint8_t> halfLap;
+	std::vector<int> nextLeftTurn;
+	std::vector<int> nextRightTurn;
+
+	int size() const {
+		return (int)pos.size();
+	}
+
+	void assign(int count) {
+		targetPos.assign(count, glm::vec3(0.0f));
+		pos.assign(count, glm::vec3(0.0f));
+		forwardDir.assign(count, glm::vec3(0.0f));
+		velocity.assign(count, 0.0f);
+		topSpeed.assign(count, 0.0f);
+		steeringAng.assign(count, 0.0f);
+		nextAng.assign(count, 0.0f);
+		laps.assign(count, 0);
+		halfLap.assign(count, 0);
+		nextLeftTurn.assign(count, 0);
+		nextRightTurn.assign(count, 0);
+	}
+};
+
+// Input of the player car
+struct RaceInput {
+	float throttle = 0.0f;		// > 0 accelerates, < 0 brakes and then reverses
+	float steer = 0.0f;			// > 0 turns right
+	bool handbrake = false;
+};
+
+enum RaceEvent {
+	RACE_EVENT_CHECKPOINT = 1,	// the player crossed an intermediate checkpoint
+	RACE_EVENT_LAP = 2,			// the player completed a lap
+	RACE_EVENT_FINISH = 4		// a car completed the last lap
+};
+
+struct RaceState {
+	RaceCars cars;
+	int currentCheckpoint = 0;		// next checkpoint of the player
+	glm::vec3 playerPreviousPos = glm::vec3(0.0f);
+	float steeringSpeed = glm::radians(75.0f);
+	bool ended = false;
+	int winner = -1;
+	double time = 0.0;
+};
+
+class RaceSimulation {
+public:
+	static const int playerCar = 0;
+
+	RaceMap map;
+	RaceState state;
+
+	const float carAcceleration = 8.0f;						// [m/s^2]
+	const float brakingStrength = 30.0f;
+	const float gravity = 9.81f;								// [m/s^2]
+	const float friction = 0.7f * gravity;
+	const float carDamping = 5.0f;
+	const float maxVelocity = 70.0f;
+	const float maxReverseVelocity = 15.0f;
+	const float carSpacing = 4.0f;							// [m] between the cars on the grid
+
+	// Builds the track from the map JSON and puts carCount cars on the start line
+	void init(const nlohmann::json &json, int carCount) {
+		map = RaceMap();
+		loadMap(json);
+		reset(carCount);
+	}
+
+	// Restarts the race on the same track. The bots are lined up behind the player, carSpacing apart along
+	// the road (closer when the field is longer than a lap), or behind the start tile when the track is not a loop
+	void reset(int carCount) {
+		if (carCount < 1) {
+			throw std::runtime_error("a race needs at least the player car!");
+		}
+		state = RaceState();
+		RaceCars &C = state.cars;
+		C.assign(carCount);
+		float lap = lapLength();
+		float spacing = lap > 0.0f ? std::min(carSpacing, lap / carCount) : carSpacing;
+		for (int i = 0; i < carCount; i++) {
+			C.targetPos[i] = map.startPosition;
+			C.topSpeed[i] = maxVelocity;
+			if (i != playerCar) {
+				placeBehindStart(i, spacing * i);
+				// Top speeds spread from maxVelocity down to maxVelocity - 50 (25 and 50 less with two bots)
+				C.topSpeed[i] -= 50.0f * i / std::max(2, carCount - 1);
+			}
+			C.pos[i] = C.targetPos[i];
+		}
+		state.playerPreviousPos = C.pos[playerCar];
+	}
+
+	// Advances the race by dt, returns a mask of RaceEvent
+	uint32_t step(const RaceInput &input, float dt) {
+		uint32_t events = 0;
+		if (!state.ended) {
+			carsMotion(input, dt);
+			events = checkpoints(dt);
+		} else {
+			state.cars.steeringAng[state.winner] += 15.0f * state.steeringSpeed * dt;
+		}
+		state.time += dt;
+		return events;
+	}
+
+	static RoadType roadTypeFromString(const std::string &name) {
+		if (name == "STRAIGHT") return STRAIGHT;
+		if (name == "LEFT") return LEFT;
+		if (name == "RIGHT") return RIGHT;
+		if (name == "NONE") return NONE;
+		throw std::invalid_argument("Invalid enum string: " + name);
+	}
+
+private:
+	void initTiles() {
+		map.indexes.assign(DIRECTIONS, {});
+		map.tiles.assign(map.size, std::vector<RoadPosition>(map.size));
+		for (int i = 0; i < map.tiles.size(); i++) {
+			for (int j = 0; j < map.tiles[i].size(); j++) {
+				float x = SCALING_FACTOR * (j - map.center);
+				float z = SCALING_FACTOR * (i - map.center);
+				map.tiles[i][j].pos = glm::vec3(x, 0.0f, z);
+				map.tiles[i][j].type = RoadType::NONE;
+				map.tiles[i][j].rotation = 0.0f;
+				map.indexes[RoadType::NONE].push_back(std::make_pair(i, j));
+			}
+		}
+	}
+
+	void loadMap(const nlohmann::json &json) {
+		// Grid size: taken from the JSON when present, grown anyway to hold every road piece
+		map.size = json.contains("size") ? (int)json["size"] : DEFAULT_MAP_SIZE;
+		for (const auto& road : json["_map"]) {
+			map.size = std::max({ map.size, (int)road["row"] + 1, (int)road["col"] + 1 });
+		}
+		map.center = map.size / 2;
+
+		initTiles();
+		std::pair<int, int> previousItemIndex = std::make_pair(json["start"]["row"], json["start"]["col"]);
+
+		// Set the initial rotation of the car
+		map.initialRotation = ((int)json["_map"][1]["col"] - previousItemIndex.second > 0) ? 270.0f :
+							  ((int)json["_map"][1]["col"] - previousItemIndex.second < 0) ? 90.0f :
+							  ((int)json["_map"][1]["row"] - previousItemIndex.first < 0) ? 0.0f : 180.0f;
+		map.tiles[previousItemIndex.first][previousItemIndex.second].rotation = map.initialRotation;
+
+		int lastCpIndex = 0;
+		for (const auto& [jsonKey, jsonValues] : json.items()) {
+			if (jsonKey == "_map") {
+				for (const auto& [mapKey, mapValues] : jsonValues.items()) { //Retrieves the road position and type and creates it
+					std::pair <int, int> index = std::make_pair(mapValues["row"], mapValues["col"]);
+					RoadType type = roadTypeFromString(mapValues["type"]);
+					map.tiles[index.first][index.second].type = type;
+
+					// Add the index to the corresponding type and remove the index from the NONE type
+					map.indexes[type].push_back(index);
+					map.indexes[RoadType::NONE].erase(std::remove(map.indexes[RoadType::NONE].begin(), map.indexes[RoadType::NONE].end(), index), map.indexes[RoadType::NONE].end());
+
+					rotationHandler(previousItemIndex, index, type);
+					previousItemIndex = index;
+
+					if (type != NONE) {
+						map.roadsPosition.push_back(map.tiles[index.first][index.second].pos);
+						map.roadsType.push_back(type);
+					}
+				}
+			}
+			else if (jsonKey == "checkpoints") {
+				for (const auto& [cpKey, cpValues] : jsonValues.items()) { //Retrieves the checkpoint position and rotation and creates it
+					std::pair <int, int> checkpointPosIndex = std::make_pair(cpValues["row"], cpValues["col"]);
+					lastCpIndex = std::stoi(cpKey);
+					const RoadPosition &tile = map.tiles[checkpointPosIndex.first][checkpointPosIndex.second];
+					initCheckpoint(tile.pos, tile.rotation, lastCpIndex);
+				}
+			}
+			else if (jsonKey == "start") { //Sets the starting position of the cars
+				map.startPosition = map.tiles[jsonValues["row"]][jsonValues["col"]].pos;
+			}
+			else if (jsonKey == "end") { //Sets the end position of the track
+				std::pair <int, int> endPosIndex;
+				if (jsonValues == nullptr) {
+					endPosIndex = std::make_pair(json["_map"].back()["row"], json["_map"].back()["col"]);
+				}
+				else {
+					endPosIndex = std::make_pair(jsonValues["row"], jsonValues["col"]);
+					map.laps = 1;
+				}
+				if (map.checkpoints.size() > 0) lastCpIndex++;
+				const RoadPosition &tile = map.tiles[endPosIndex.first][endPosIndex.second];
+				map.endPosition = tile.pos;
+				initCheckpoint(tile.pos, tile.rotation, lastCpIndex);
+			}
+		}
+
+		int mid = (map.roadsPosition.size() - 1) / 2;
+		map.centerRoadPosition = map.roadsPosition[mid];
+	}
+
+	// Length of a lap when the road closes on the start and the finish line is its last piece, 0 otherwise
+	float lapLength() const {
+		const std::vector<glm::vec3> &road = map.roadsPosition;
+		if (map.laps < 2 || road.size() < 3 || glm::length(road.front() - road.back()) > SCALING_FACTOR + 0.01f) {
+			return 0.0f;
+		}
+		float length = glm::length(road.front() - road.back());
+		for (size_t k = 1; k < road.size(); k++) {
+			length += glm::length(road[k] - road[k - 1]);
+		}
+		return length;
+	}
+
+	// Puts a bot distance meters behind the start, heading along the road, with the lap, half lap and turn
+	// cursors of a bot that got there by driving: the bots between the last piece and the start are in the
+	// first lap, the others still have to cross the finish line
+	void placeBehindStart(int carIndex, float distance) {
+		RaceCars &C = state.cars;
+		const std::vector<glm::vec3> &road = map.roadsPosition;
+		float startHeading = glm::radians(180.0f + map.initialRotation);
+		if (lapLength() == 0.0f) {
+			C.targetPos[carIndex] = map.startPosition - glm::vec3(glm::sin(startHeading), 0.0f, glm::cos(startHeading)) * distance;
+			return;
+		}
+
+		// Walks the road backwards from the start: the bot is on piece k, t of the way to the next one
+		int last = (int)road.size() - 1;
+		int next = 0;
+		int k = last;
+		float t = 0.0f;
+		while (true) {
+			k = (next + last) % (last + 1);
+			float length = glm::length(road[next] - road[k]);
+			if (distance <= length) {
+				t = 1.0f - distance / length;
+				break;
+			}
+			distance -= length;
+			next = k;
+		}
+		glm::vec3 direction = road[next] - road[k];
+		C.targetPos[carIndex] = road[k] + direction * t;
+		C.steeringAng[carIndex] = std::atan2(direction.x, direction.z) - startHeading;
+		C.forwardDir[carIndex] = glm::normalize(direction);
+
+		if (k == last && t > 0.0f) {
+			return;
+		}
+		int mid = last / 2;
+		C.laps[carIndex] = -1;
+		C.halfLap[carIndex] = k > mid || (k == mid && t > 0.0f);
+		// The next turns are the first ones after piece k, none when the rest of the lap is straight
+		int left = 0, right = 0;
+		for (int j = 0; j <= k; j++) {
+			left += map.roadsType[j] == LEFT;
+			right += map.roadsType[j] == RIGHT;
+		}
+		C.nextLeftTurn[carIndex] = left < (int)map.indexes[LEFT].size() ? left : -1;
+		C.nextRightTurn[carIndex] = right < (int)map.indexes[RIGHT].size() ? right : -1;
+	}
+
+	void initCheckpoint(glm::vec3 checkpointPos, float rotation, int id) {
+		glm::mat4 rotationMatrix = glm::rotate(glm::mat4(1.0f), glm::radians(rotation), glm::vec3(0.0f, 1.0f, 0.0f));
+		map.checkpoints[id].position = checkpointPos;
+		map.checkpoints[id].pointA = checkpointPos + glm::vec3(rotationMatrix * glm::vec4(-map.checkpointOffset, 0.0f, map.checkpointOffset, 1.0f));
+		map.checkpoints[id].pointB = checkpointPos + glm::vec3(rotationMatrix * glm::vec4(map.checkpointOffset, 0.0f, map.checkpointOffset, 1.0f));
+	}
+
+	//Handles the rotation of the road pieces
+	void rotationHandler(std::pair<int, int>& previousItemIndex, std::pair<int, int>& index, int type) {
+		//if the current item is a turn depending on the current rotation and the type of the turn, the rotation is updated
+		int dRow = previousItemIndex.first - index.first;    // x difference
+		int dCol = previousItemIndex.second - index.second;  // y difference
+
+		if (dRow != 0 && dCol != 0) {
+			// Row and Column are both different from the previous road block, which is an error
+			std::cerr << "Invalid map configuration, Row and Column are both different from the previous road block"
+				<< ((abs(dRow) > abs(dCol)) ? " (Col problem)" : " (Row problem)") << std::endl;
+			std::cerr << "The road blocks are not connected or in wrong order in the map file" << std::endl;
+			std::cerr << "Previous road block: " << previousItemIndex.first << " " << previousItemIndex.second << std::endl;
+			std::cerr << "Current road block: " << index.first << " " << index.second << std::endl;
+			std::cerr << "Rotation defaulted to 0.0f" << std::endl;
+		}
+		else {
+			float &rotation = map.tiles[index.first][index.second].rotation;
+			if (dRow > 0)
+				rotation = (type == LEFT) ? 270.0f : (type == RIGHT) ? 0.0f : 0.0f;
+			else if (dRow < 0)
+				rotation = (type == LEFT) ? 90.0f : (type == RIGHT) ? 180.0f : 0.0f;
+			else if (dCol > 0)
+				rotation = (type == LEFT) ? 0.0f : (type == RIGHT) ? 90.0f : 90.0f;
+			else if (dCol < 0)
+				rotation = (type == LEFT) ? 180.0f : (type == RIGHT) ? 270.0f : 90.0f;
+		}
+	}
+
+	// Checkpoints of the player, laps of the bots and end of the race
+	uint32_t checkpoints(float dt) {
+		RaceCars &C = state.cars;
+		uint32_t events = 0;
+		if (isBetweenPoints(C.pos[playerCar], map.checkpoints[state.currentCheckpoint])) {
+			state.currentCheckpoint++;
+			if (state.currentCheckpoint == map.checkpoints.size()) {
+				state.currentCheckpoint = 0;
+				C.laps[playerCar] += 1;
+				events |= RACE_EVENT_LAP;
+			}
+			else {
+				events |= RACE_EVENT_CHECKPOINT;
+			}
+		}
+
+		const glm::vec3 &finishLine = map.checkpoints[map.checkpoints.size() - 1].position;
+		for (int i = 0; i < C.size(); i++) {
+			if (i == playerCar) {
+				continue;
+			}
+			if (!C.halfLap[i]) {
+				C.halfLap[i] = checkDistance(map.centerRoadPosition, i, dt);
+			}
+			else if (checkDistance(finishLine, i, dt)) {
+				lapUpdatingHandler(i);
+			}
+		}
+
+		for (int i = 0; i < C.size(); i++) {
+			if (C.laps[i] == map.laps) {
+				events |= winnerHandler(i);
+			}
+		}
+		return events;
+	}
+
+	// A bot crossed the finish line: the turns of the new lap start again from the first one
+	void lapUpdatingHandler(int carIndex) {
+		RaceCars &C = state.cars;
+		C.laps[carIndex]++;
+		C.halfLap[carIndex] = 0;
+		C.nextLeftTurn[carIndex] = 0;
+		C.nextRightTurn[carIndex] = 0;
+	}
+
+	uint32_t winnerHandler(int carIndex) {
+		state.ended = true;
+		state.winner = carIndex;
+		state.cars.pos[carIndex] = map.endPosition;
+		return RACE_EVENT_FINISH;
+	}
+
+	// Checks if the player is crossing the checkpoint
+	bool isBetweenPoints(const glm::vec3& carPos, const Checkpoint& checkpoint) {
+		bool isInRoad = false;
+		bool checkpointIsCrossed = false;
+		float epsilon = 0.0001f;
+		float outOfRoadTollerance = 1.5f;
+		float zToCross = checkpoint.pointA.z;
+		float xToCross = checkpoint.pointA.x;
+		const glm::vec3 &previousPos = state.playerPreviousPos;
+
+		if (abs(checkpoint.pointA.z - checkpoint.pointB.z) < epsilon) { // MOVING ALONG Z
+			if (zToCross - previousPos.z > 0.0f) { //POSITIVE Z AXES
+				checkpointIsCrossed = carPos.z >= zToCross;
+			}
+			else if (zToCross - previousPos.z < 0.0f) { // NEGATIVE Z AXES
+				checkpointIsCrossed = carPos.z <= zToCross;
+			}
+			isInRoad = carPos.x <= glm::max(checkpoint.pointA.x, checkpoint.pointB.x) + outOfRoadTollerance && carPos.x >= glm::min(checkpoint.pointA.x, checkpoint.pointB.x) - outOfRoadTollerance;
+		}
+		else if (abs(checkpoint.pointA.x - checkpoint.pointB.x) < epsilon) { // MOVING ALONG X
+			if (xToCross - previousPos.x > 0.0f) { // POSITIVE X AXES
+				checkpointIsCrossed = carPos.x >= xToCross;
+			}
+			else if (xToCross - previousPos.x < 0.0f) { // NEGATIVE X AXES
+				checkpointIsCrossed = carPos.x <= xToCross;
+			}
+			isInRoad = carPos.z <= glm::max(checkpoint.pointA.z, checkpoint.pointB.z) + outOfRoadTollerance && carPos.z >= glm::min(checkpoint.pointA.z, checkpoint.pointB.z) - outOfRoadTollerance;
+		}
+		return isInRoad && checkpointIsCrossed;
+	}
+
+	// Dynamics of the player car, and the bots following the track
+	void carsMotion(const RaceInput &input, float dt) {
+		RaceCars &C = state.cars;
+		float &velocity = C.velocity[playerCar];
+		float steer = input.steer;
+
+		if (input.handbrake && velocity > 0) {
+			velocity -= brakingStrength * 2 * dt;
+		}
+		state.steeringSpeed = input.handbrake ? glm::radians(90.0f) : glm::radians(60.0f);
+
+		// Handle acceleration/braking
+		if (input.throttle > 0) {
+			if (velocity >= 0) {
+				velocity += carAcceleration * dt;
+				velocity = glm::min(velocity, C.topSpeed[playerCar]);
+			}
+			else {
+				velocity += brakingStrength * dt;
+			}
+		}
+		else if (input.throttle < 0) {
+			if (velocity > 0) { // car is moving forward, decelerate
+				velocity -= brakingStrength * dt;
+			}
+			else { // car is moving backwards, accelerate in the opposite direction
+				steer *= -1;
+				velocity -= carAcceleration * dt;
+				velocity = glm::max(velocity, -maxReverseVelocity);
+			}
+		}
+		else { // no acceleration or deceleration
+			if (velocity > 0.0f) {
+				velocity -= friction * dt;
+				velocity = glm::max(velocity, 0.0f);
+			}
+			else if (velocity < 0.0f) {
+				steer *= -1;
+				velocity += friction * dt;
+				velocity = glm::min(velocity, 0.0f);
+			}
+		}
+
+		// Handle steering
+		if (velocity != 0.0f) {
+			C.steeringAng[playerCar] += -steer * state.steeringSpeed * dt;
+		}
+
+		// Fraction of the distance from the target kept by the damping in this step, the same for every car
+		float damping = std::exp(-carDamping * dt);
+		updateCarPosition(playerCar, dt, damping);
+
+		for (int i = 0; i < C.size(); i++) {
+			if (i == playerCar) {
+				continue;
+			}
+			if (C.nextAng[i] == 0.0f) {
+				manageCarDirection(i, dt, damping);
+			}
+			else {
+				C.steeringAng[i] += C.nextAng[i];
+				C.nextAng[i] = 0.0f;
+			}
+			C.pos[i] = C.pos[i] * damping + C.targetPos[i] * (1 - damping);
+		}
+	}
+
+	// Bots: turns at the next turn piece of the lap, otherwise accelerates along the road
+	void manageCarDirection(int carIndex, float dt, float damping) {
+		RaceCars &C = state.cars;
+		int &nextLeft = C.nextLeftTurn[carIndex];
+		int &nextRight = C.nextRightTurn[carIndex];
+
+		if (map.indexes[LEFT].size() != 0 && nextLeft != -1) {
+			const std::pair<int, int> &turn = map.indexes[LEFT][nextLeft];
+			if (checkDistance(map.tiles[turn.first][turn.second].pos, carIndex, dt)) {
+				C.nextAng[carIndex] = glm::radians(90.0f);
+				nextLeft = (nextLeft < map.indexes[LEFT].size() - 1) ? nextLeft + 1 : -1;
+				C.targetPos[carIndex] = map.tiles[turn.first][turn.second].pos;
+				return;
+			}
+		}
+		if (map.indexes[RIGHT].size() != 0 && nextRight != -1) {
+			const std::pair<int, int> &turn = map.indexes[RIGHT][nextRight];
+			if (checkDistance(map.tiles[turn.first][turn.second].pos, carIndex, dt)) {
+				C.nextAng[carIndex] = -glm::radians(90.0f);
+				nextRight = (nextRight < map.indexes[RIGHT].size() - 1) ? nextRight + 1 : -1;
+				C.targetPos[carIndex] = map.tiles[turn.first][turn.second].pos;
+				return;
+			}
+		}
+		C.velocity[carIndex] += carAcceleration * dt;
+		C.velocity[carIndex] = glm::min(C.velocity[carIndex], C.topSpeed[carIndex]);
+		updateCarPosition(carIndex, dt, damping);
+	}
+
+	// Updates the car position based on the car velocity and steering angle
+	void updateCarPosition(int carIndex, float dt, float damping) {
+		RaceCars &C = state.cars;
+		float heading = C.steeringAng[carIndex] + glm::radians(180.0f + map.initialRotation);
+		C.forwardDir[carIndex] = glm::vec3(glm::sin(heading), 0.0f, glm::cos(heading));
+
+		C.targetPos[carIndex] += C.forwardDir[carIndex] * C.velocity[carIndex] * dt;
+		if (carIndex == playerCar) {
+			state.playerPreviousPos = C.pos[carIndex];
+		}
+		C.pos[carIndex] = C.pos[carIndex] * damping + C.targetPos[carIndex] * (1 - damping);
+	}
+
+	// Checks if the car is close to the target position: the tolerance is the distance covered in a step
+	bool checkDistance(const glm::vec3 &targetPos, int carIndex, float dt) {
+		const glm::vec3 &pos = state.cars.pos[carIndex];
+		const glm::vec3 &forwardDir = state.cars.forwardDir[carIndex];
+		float potVelocity = state.cars.velocity[carIndex] + (2 * carAcceleration * dt);
+		bool checkOnX = abs(pos.x - targetPos.x) <= abs(forwardDir.x * potVelocity * dt) + abs(potVelocity * dt);
+		bool checkOnZ = abs(pos.z - targetPos.z) <= abs(forwardDir.z * potVelocity * dt) + abs(potVelocity * dt);
+		return (checkOnX && checkOnZ);
+	}
+};
@@ -12,6 +12,7 @@
 #include <fstream>
 #include <array>
 #include <cmath>
+#include <limits>
 #include <math.h>
 
 #define GLM_FORCE_RADIANS
@@ -23,6 +24,18 @@
 #include <glm/gtx/transform2.hpp>
 
 #include <chrono>
+#include <atomic>
+#include <new>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <exception>
+#include <filesystem>
+
+#include "Profiler.hpp"
+#include "AssetPack.hpp"
+#include "VertexPacker.hpp"
+#include "MeshOptimizer.hpp"
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
@@ -43,6 +56,8 @@
 #define SINFL_IMPLEMENTATION
 #include <sinfl.h>
 
+#include "Benchmark.hpp"
+
 // For compile compatibility issues
 #define M_E			2.7182818284590452354	/* e */
 #define M_LOG2E		1.4426950408889634074	/* log_2 e */
@@ -61,6 +76,25 @@
 
 const int MAX_FRAMES_IN_FLIGHT = 2;
 
+// Counts every C++ heap allocation of the process, used to check that the frame loop does not allocate
+std::atomic<uint64_t> heapAllocationCount{0};
+
+void* operator new(std::size_t size) {
+	heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+	if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+	std::free(ptr);
+}
+
 const std::vector<const char*> validationLayers = {
 	"VK_LAYER_KHRONOS_validation"
 };
@@ -157,24 +191,325 @@ void PrintVkError( VkResult result ) {
 }
 
 
+// A copy of the asset, readAsset() returns a view when it comes from the pack
 std::vector<char> readFile(const std::string& filename) {
-	std::ifstream file(filename, std::ios::ate | std::ios::binary);
-	if (!file.is_open()) {
-		std::cout << "Failed to open: " << filename << "\n";
-		throw std::runtime_error("failed to open file!");
+	Asset asset = readAsset(filename);
+	if (!asset.view) {
+		return std::move(asset.loose);
 	}
-	
-	size_t fileSize = (size_t) file.tellg();
-	std::vector<char> buffer(fileSize);
-//std::cout << filename << " -> " << fileSize << " B\n";	 
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
-	 
-	file.close();
-	 
-	return buffer;
+	return std::vector<char>(asset.view, asset.view + asset.viewSize);
 }
 
+// GPU memory sub-allocation: resources get an offset into a few large VkDeviceMemory blocks.
+// Long-lived resources use a buddy allocator, transient ones (staging buffers) a linear arena
+// that rewinds when all its allocations are released.
+enum GpuMemoryLifetime {
+	GPU_MEMORY_PERSISTENT,
+	GPU_MEMORY_TRANSIENT
+};
+
+struct GpuAllocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	void *mapped = nullptr;		// offset already applied, null if the memory is not host visible
+	int block = -1;
+};
+
+struct GpuMemoryBlock {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize size = 0;
+	void *mapped = nullptr;
+	uint32_t memoryType = 0;
+	bool optimalImages = false;	// kept apart from buffers to respect bufferImageGranularity
+	GpuMemoryLifetime lifetime = GPU_MEMORY_PERSISTENT;
+	bool dedicated = false;
+
+	// buddy allocator: free offsets for each order, order 0 being minBuddySize
+	std::vector<std::set<VkDeviceSize>> freeLists;
+	std::vector<std::pair<VkDeviceSize, int>> allocatedOrders;
+	// linear arena
+	VkDeviceSize head = 0;
+
+	VkDeviceSize used = 0;
+	uint32_t allocations = 0;
+};
+
+struct GpuMemoryStats {
+	uint32_t blocks = 0;
+	uint32_t deviceAllocations = 0;	// vkAllocateMemory calls since init
+	uint32_t liveAllocations = 0;
+	uint32_t totalAllocations = 0;
+	VkDeviceSize reservedBytes = 0;
+	VkDeviceSize usedBytes = 0;
+	VkDeviceSize requestedBytes = 0;
+	VkDeviceSize peakUsedBytes = 0;
+};
+
+class GpuMemoryAllocator {
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties memProperties{};
+	std::vector<GpuMemoryBlock> blocks;
+	std::vector<int> freeBlockSlots;
+	GpuMemoryStats stats;
+
+	static const VkDeviceSize blockSize = 64 * 1024 * 1024;
+	static const VkDeviceSize transientBlockSize = 32 * 1024 * 1024;
+	static const VkDeviceSize minBuddySize = 256;
+
+	static int buddyOrders() {
+		int orders = 1;
+		while ((minBuddySize << (orders - 1)) < blockSize) {
+			orders++;
+		}
+		return orders;
+	}
+
+	int createBlock(VkDeviceSize size, uint32_t memoryType, bool optimalImages,
+					GpuMemoryLifetime lifetime, bool dedicated) {
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = size;
+		allocInfo.memoryTypeIndex = memoryType;
+
+		GpuMemoryBlock B;
+		VkResult result = vkAllocateMemory(device, &allocInfo, nullptr, &B.memory);
+		if (result != VK_SUCCESS) {
+		 	PrintVkError(result);
+			throw std::runtime_error("failed to allocate device memory block!");
+		}
+		B.size = size;
+		B.memoryType = memoryType;
+		B.optimalImages = optimalImages;
+		B.lifetime = lifetime;
+		B.dedicated = dedicated;
+
+		// Host visible blocks are mapped once: every allocation in them gets a pointer at its offset
+		if (memProperties.memoryTypes[memoryType].propertyFlags &
+					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+			result = vkMapMemory(device, B.memory, 0, VK_WHOLE_SIZE, 0, &B.mapped);
+			if (result != VK_SUCCESS) {
+			 	PrintVkError(result);
+				throw std::runtime_error("failed to map device memory block!");
+			}
+		}
+
+		if (!dedicated && lifetime == GPU_MEMORY_PERSISTENT) {
+			B.freeLists.resize(buddyOrders());
+			B.freeLists.back().insert(0);
+		}
+
+		stats.blocks++;
+		stats.deviceAllocations++;
+		stats.reservedBytes += size;
+
+		if (!freeBlockSlots.empty()) {
+			int slot = freeBlockSlots.back();
+			freeBlockSlots.pop_back();
+			blocks[slot] = std::move(B);
+			return slot;
+		}
+		blocks.push_back(std::move(B));
+		return static_cast<int>(blocks.size()) - 1;
+	}
+
+	void destroyBlock(int slot) {
+		GpuMemoryBlock &B = blocks[slot];
+		if (B.mapped) {
+			vkUnmapMemory(device, B.memory);
+		}
+		vkFreeMemory(device, B.memory, nullptr);
+		stats.blocks--;
+		stats.reservedBytes -= B.size;
+		B = GpuMemoryBlock();
+		freeBlockSlots.push_back(slot);
+	}
+
+	bool buddyAllocate(GpuMemoryBlock &B, int order, VkDeviceSize &offset) {
+		int j = order;
+		while (j < static_cast<int>(B.freeLists.size()) && B.freeLists[j].empty()) {
+			j++;
+		}
+		if (j == static_cast<int>(B.freeLists.size())) {
+			return false;
+		}
+		offset = *B.freeLists[j].begin();
+		B.freeLists[j].erase(B.freeLists[j].begin());
+		// split down to the requested order, keeping the upper halves free
+		while (j > order) {
+			j--;
+			B.freeLists[j].insert(offset + (minBuddySize << j));
+		}
+		B.allocatedOrders.push_back({offset, order});
+		return true;
+	}
+
+	VkDeviceSize buddyFree(GpuMemoryBlock &B, VkDeviceSize offset) {
+		int order = -1;
+		for (size_t i = 0; i < B.allocatedOrders.size(); i++) {
+			if (B.allocatedOrders[i].first == offset) {
+				order = B.allocatedOrders[i].second;
+				B.allocatedOrders[i] = B.allocatedOrders.back();
+				B.allocatedOrders.pop_back();
+				break;
+			}
+		}
+		// not allocated from this block, or freed twice: inserting it would hand the range out again
+		if (order < 0) {
+			throw std::runtime_error("freeing device memory that is not allocated!");
+		}
+		VkDeviceSize freedSize = minBuddySize << order;
+		// merge with the buddy as long as it is free
+		while (order < static_cast<int>(B.freeLists.size()) - 1) {
+			VkDeviceSize buddy = offset ^ (minBuddySize << order);
+			auto it = B.freeLists[order].find(buddy);
+			if (it == B.freeLists[order].end()) {
+				break;
+			}
+			B.freeLists[order].erase(it);
+			offset = std::min(offset, buddy);
+			order++;
+		}
+		B.freeLists[order].insert(offset);
+		return freedSize;
+	}
+
+public:
+	void init(VkPhysicalDevice physicalDevice, VkDevice dev) {
+		device = dev;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+	}
+
+	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
+		for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+			if ((typeFilter & (1 << i)) &&
+				(memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+				return i;
+			}
+		}
+		throw std::runtime_error("failed to find suitable memory type!");
+	}
+
+	GpuAllocation allocate(const VkMemoryRequirements &req, VkMemoryPropertyFlags properties,
+						   bool optimalImage, GpuMemoryLifetime lifetime) {
+		uint32_t memoryType = findMemoryType(req.memoryTypeBits, properties);
+		VkDeviceSize alignment = std::max<VkDeviceSize>(req.alignment, 1);
+		GpuAllocation A;
+		A.size = req.size;
+
+		VkDeviceSize poolBlockSize = lifetime == GPU_MEMORY_PERSISTENT ? blockSize : transientBlockSize;
+		if (req.size > poolBlockSize / 2) {
+			// too big to share a block: it gets its own
+			A.block = createBlock(req.size, memoryType, optimalImage, lifetime, true);
+			A.offset = 0;
+			blocks[A.block].used = req.size;
+		} else if (lifetime == GPU_MEMORY_TRANSIENT) {
+			for (size_t i = 0; i < blocks.size() && A.block < 0; i++) {
+				GpuMemoryBlock &B = blocks[i];
+				if (B.memory == VK_NULL_HANDLE || B.dedicated || B.lifetime != lifetime ||
+					B.memoryType != memoryType || B.optimalImages != optimalImage) {
+					continue;
+				}
+				VkDeviceSize offset = (B.head + alignment - 1) / alignment * alignment;
+				if (offset + req.size <= B.size) {
+					A.block = static_cast<int>(i);
+					A.offset = offset;
+				}
+			}
+			if (A.block < 0) {
+				A.block = createBlock(poolBlockSize, memoryType, optimalImage, lifetime, false);
+				A.offset = 0;
+			}
+			blocks[A.block].head = A.offset + req.size;
+			blocks[A.block].used += req.size;
+		} else {
+			// buddy nodes are aligned to their own size, so rounding up to the alignment is enough
+			int order = 0;
+			while ((minBuddySize << order) < std::max(req.size, alignment)) {
+				order++;
+			}
+			for (size_t i = 0; i < blocks.size() && A.block < 0; i++) {
+				GpuMemoryBlock &B = blocks[i];
+				if (B.memory == VK_NULL_HANDLE || B.dedicated || B.lifetime != lifetime ||
+					B.memoryType != memoryType || B.optimalImages != optimalImage) {
+					continue;
+				}
+				if (buddyAllocate(B, order, A.offset)) {
+					A.block = static_cast<int>(i);
+				}
+			}
+			if (A.block < 0) {
+				A.block = createBlock(poolBlockSize, memoryType, optimalImage, lifetime, false);
+				buddyAllocate(blocks[A.block], order, A.offset);
+			}
+			blocks[A.block].used += minBuddySize << order;
+		}
+
+		GpuMemoryBlock &B = blocks[A.block];
+		B.allocations++;
+		A.memory = B.memory;
+		A.mapped = B.mapped ? static_cast<char *>(B.mapped) + A.offset : nullptr;
+
+		stats.liveAllocations++;
+		stats.totalAllocations++;
+		stats.requestedBytes += req.size;
+		stats.usedBytes = 0;
+		for (const GpuMemoryBlock &b : blocks) {
+			stats.usedBytes += b.used;
+		}
+		stats.peakUsedBytes = std::max(stats.peakUsedBytes, stats.usedBytes);
+		return A;
+	}
+
+	void release(GpuAllocation &A) {
+		if (A.block < 0) {
+			return;
+		}
+		GpuMemoryBlock &B = blocks[A.block];
+		if (B.dedicated) {
+			stats.usedBytes -= B.used;
+			destroyBlock(A.block);
+		} else {
+			VkDeviceSize freed = A.size;
+			if (B.lifetime == GPU_MEMORY_TRANSIENT) {
+				if (B.allocations == 1) {
+					B.head = 0;	// arena empty: rewind
+				}
+			} else {
+				freed = buddyFree(B, A.offset);
+			}
+			B.used -= freed;
+			B.allocations--;
+			stats.usedBytes -= freed;
+		}
+		stats.liveAllocations--;
+		stats.requestedBytes -= A.size;
+		A = GpuAllocation();
+	}
+
+	void cleanup() {
+		for (size_t i = 0; i < blocks.size(); i++) {
+			if (blocks[i].memory != VK_NULL_HANDLE) {
+				destroyBlock(static_cast<int>(i));
+			}
+		}
+		blocks.clear();
+		freeBlockSlots.clear();
+	}
+
+	const GpuMemoryStats &getStats() const { return stats; }
+
+	void printStats() const {
+		std::cout << "GPU memory: " << stats.liveAllocations << " allocations in "
+				  << stats.blocks << " blocks (" << stats.deviceAllocations
+				  << " vkAllocateMemory calls), "
+				  << stats.requestedBytes / 1024 << " KB requested, "
+				  << stats.usedBytes / 1024 << " KB used, "
+				  << stats.reservedBytes / 1024 << " KB reserved, peak "
+				  << stats.peakUsedBytes / 1024 << " KB\n";
+	}
+};
+
 class BaseProject;
 
 struct VertexBindingDescriptorElement {
@@ -210,7 +545,11 @@ struct VertexDescriptor {
 
 	std::vector<VertexBindingDescriptorElement> Bindings;
 	std::vector<VertexDescriptorElement> Layout;
- 	
+
+	// The per-vertex binding, filled by the model loaders; the per-instance ones are fed by InstanceBuffers
+	uint32_t meshBinding;
+	uint32_t meshStride;
+ 	 	
  	void init(BaseProject *bp, std::vector<VertexBindingDescriptorElement> B, std::vector<VertexDescriptorElement> E);
 	void cleanup();
 
@@ -221,41 +560,245 @@ struct VertexDescriptor {
 
 enum ModelType {OBJ, GLTF, MGCG};
 
+// On-disk cache of the meshes as the loaders leave them: the interleaved vertex bytes, the 32 bit indices and
+// the node transform, after a header. An entry is named after the source path and the vertex layout, and holds
+// the hash of the source contents: a changed source, layout or loader (version) is a miss, and the entry is rewritten
+struct MeshCacheHeader {
+	char magic[4];				// "MGMC"
+	uint32_t version;
+	uint64_t sourceHash;
+	uint64_t layoutHash;
+	uint64_t vertexBytes;
+	uint64_t indexCount;
+	float Wm[16];
+};
+
+struct MeshCache {
+	// 2: the meshes are welded and reordered by Model::optimizeMesh()
+	static const uint32_t version = 2;
+
+	// FNV-1a, 64 bit
+	static uint64_t hash(const void *data, size_t size, uint64_t h = 14695981039346656037ull) {
+		const unsigned char *p = static_cast<const unsigned char *>(data);
+		for (size_t i = 0; i < size; i++) {
+			h = (h ^ p[i]) * 1099511628211ull;
+		}
+		return h;
+	}
+
+	// The per-vertex part of the descriptor, the only one the loaders fill
+	static uint64_t layoutHash(const VertexDescriptor *VD) {
+		uint64_t h = hash(&VD->meshStride, sizeof(VD->meshStride));
+		for (const VertexDescriptorElement &E : VD->Layout) {
+			if (E.binding == VD->meshBinding) {
+				uint32_t fields[5] = { E.location, static_cast<uint32_t>(E.format), E.offset, E.size, static_cast<uint32_t>(E.usage) };
+				h = hash(fields, sizeof(fields), h);
+			}
+		}
+		return h;
+	}
+
+	static std::string path(const std::string &dir, const std::string &file, uint64_t layout) {
+		char name[40];
+		snprintf(name, sizeof(name), "/%016llx.mesh", (unsigned long long)hash(file.data(), file.size(), layout));
+		return dir + name;
+	}
+
+	// False on a miss: no entry, or one of another source, layout or version
+	static bool read(const std::string &cacheFile, uint64_t sourceHash, uint64_t layout,
+					 std::vector<unsigned char> &vertices, std::vector<uint32_t> &indices, glm::mat4 &Wm) {
+		std::ifstream in(cacheFile, std::ios::binary);
+		if (!in.is_open()) {
+			return false;
+		}
+		MeshCacheHeader H;
+		if (!in.read(reinterpret_cast<char *>(&H), sizeof(H)) || memcmp(H.magic, "MGMC", 4) != 0 ||
+			H.version != version || H.sourceHash != sourceHash || H.layoutHash != layout) {
+			return false;
+		}
+		// The arrays are read straight into the model
+		vertices.resize(H.vertexBytes);
+		indices.resize(H.indexCount);
+		if (!in.read(reinterpret_cast<char *>(vertices.data()), H.vertexBytes) ||
+			!in.read(reinterpret_cast<char *>(indices.data()), H.indexCount * sizeof(uint32_t))) {
+			vertices.clear();
+			indices.clear();
+			return false;
+		}
+		memcpy(&Wm[0][0], H.Wm, sizeof(H.Wm));
+		return true;
+	}
+
+	// Written to a temporary file and renamed, so that a reader never sees a partial entry.
+	// The cache is optional: a failure is only reported
+	static void write(const std::string &cacheFile, uint64_t sourceHash, uint64_t layout,
+					  const std::vector<unsigned char> &vertices, const std::vector<uint32_t> &indices, const glm::mat4 &Wm) {
+		std::error_code ec;
+		std::filesystem::create_directories(std::filesystem::path(cacheFile).parent_path(), ec);
+
+		MeshCacheHeader H{};
+		memcpy(H.magic, "MGMC", 4);
+		H.version = version;
+		H.sourceHash = sourceHash;
+		H.layoutHash = layout;
+		H.vertexBytes = vertices.size();
+		H.indexCount = indices.size();
+		memcpy(H.Wm, &Wm[0][0], sizeof(H.Wm));
+
+		std::string tmp = cacheFile + ".tmp" + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+		{
+			std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+			out.write(reinterpret_cast<const char *>(&H), sizeof(H));
+			out.write(reinterpret_cast<const char *>(vertices.data()), vertices.size());
+			out.write(reinterpret_cast<const char *>(indices.data()), indices.size() * sizeof(uint32_t));
+			if (!out) {
+				std::cout << "Failed to write mesh cache: " << cacheFile << "\n";
+				out.close();
+				std::filesystem::remove(tmp, ec);
+				return;
+			}
+		}
+		std::filesystem::rename(tmp, cacheFile, ec);
+		if (ec) {
+			// Another thread wrote the same entry, or the platform does not replace on rename
+			std::filesystem::remove(tmp, ec);
+		}
+	}
+};
+
+// Per-instance attributes, read from a vertex buffer bound at a VK_VERTEX_INPUT_RATE_INSTANCE binding
+// of the vertex descriptor. A per-frame buffer has a region for every swapchain image, rewritten every
+// frame, and is recreated with the swapchain like the uniform ring; a static one a single region written once
+struct InstanceBuffer {
+	BaseProject *BP;
+	uint32_t binding;
+	VkDeviceSize stride;
+	uint32_t capacity;
+	bool perFrame;
+	uint32_t regions;
+	VkBuffer buffer;
+	GpuAllocation bufferMemory;
+
+	void init(BaseProject *bp, VertexDescriptor *VD, uint32_t binding, uint32_t capacity, bool perFrame);
+	void cleanup();
+	void map(int currentImage, const void *src, uint32_t count, uint32_t first = 0);
+	void *mapped(int currentImage);
+	VkDeviceSize offset(int currentImage);
+	void bind(VkCommandBuffer commandBuffer, int currentImage);
+};
+
+class Model;
+
+// One vertex buffer and one index buffer shared by all the models of a vertex descriptor that are added to it.
+// Every model keeps where its mesh is (firstIndex, vertexOffset, indexCount), so a pipeline binds the
+// geometry once for its whole draw list. The buffers are created by upload(), after the last model is added.
+struct GeometryPool {
+	BaseProject *BP;
+	VertexDescriptor *VD;
+	std::vector<unsigned char> vertices;
+	std::vector<uint32_t> indices;
+	uint32_t models = 0;
+	bool uploaded = false;
+	VkBuffer vertexBuffer = VK_NULL_HANDLE;
+	GpuAllocation vertexBufferMemory;
+	VkBuffer indexBuffer = VK_NULL_HANDLE;
+	GpuAllocation indexBufferMemory;
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+
+	void init(BaseProject *bp, VertexDescriptor *VD);
+	void add(Model &M);
+	void upload();
+	void cleanup();
+	void bind(VkCommandBuffer commandBuffer);
+};
+
+// The indexed draws of a pipeline, each one a model of a geometry pool with a range of instances.
+// Draws without instances are dropped by add(). upload() writes the commands in a host visible indirect
+// buffer, issued by draw() as one vkCmdDrawIndexedIndirect; without multiDrawIndirect and
+// drawIndirectFirstInstance, as one vkCmdDrawIndexed per command. Like an InstanceBuffer, a per-frame
+// list has a region for every swapchain image, for lists rebuilt every frame.
+struct DrawList {
+	BaseProject *BP;
+	uint32_t capacity;
+	bool perFrame;
+	uint32_t regions;
+	std::vector<VkDrawIndexedIndirectCommand> commands;
+	VkBuffer buffer = VK_NULL_HANDLE;
+	GpuAllocation bufferMemory;
+
+	void init(BaseProject *bp, uint32_t capacity, bool perFrame);
+	void cleanup();
+	void clear();
+	void add(const Model &M, uint32_t instanceCount, uint32_t firstInstance);
+	void upload(int currentImage);
+	void draw(VkCommandBuffer commandBuffer, int currentImage);
+};
+
 class Model {
+	friend class GeometryPool;
 	BaseProject *BP;
 	
 	VkBuffer vertexBuffer;
-	VkDeviceMemory vertexBufferMemory;
+	GpuAllocation vertexBufferMemory;
 	VkBuffer indexBuffer;
-	VkDeviceMemory indexBufferMemory;
+	GpuAllocation indexBufferMemory;
 	VertexDescriptor *VD;
+	GeometryPool *pool = nullptr;
 
 	public:
 	glm::mat4 Wm;
 	std::vector<unsigned char> vertices{};
 	std::vector<uint32_t> indices{};
+	// Where the mesh is in the bound index and vertex buffers (always 0 for a model with its own buffers)
+	uint32_t firstIndex = 0;
+	int32_t vertexOffset = 0;
+	uint32_t indexCount = 0;
+	// UINT16 when every index fits, set by createIndexBuffer()
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+	// Bounding sphere of the mesh in model space: xyz center, w radius
+	glm::vec4 bounds = glm::vec4(0.0f);
 	void loadModelOBJ(std::string file);
 	void loadModelGLTF(std::string file, bool encoded);
+	// The loaders in two steps: parse the file, then pack its vertices in the layout of VD
+	void parseOBJ(const std::string &file, tinyobj::attrib_t &attrib, std::vector<tinyobj::shape_t> &shapes);
+	void packOBJ(const tinyobj::attrib_t &attrib, const std::vector<tinyobj::shape_t> &shapes);
+	void parseGLTF(const std::string &file, bool encoded, tinygltf::Model &model);
+	void packGLTF(const tinygltf::Model &model);
+	void optimizeMesh();
+	static void benchmarkLoaders(VertexDescriptor *VD, const std::string &dir, int iterations);
 	void createIndexBuffer();
 	void createVertexBuffer();
-
-	void init(BaseProject *bp, VertexDescriptor *VD, std::string file, ModelType MT);
-	void initMesh(BaseProject *bp, VertexDescriptor *VD);
+	void computeBounds();
+
+	void init(BaseProject *bp, VertexDescriptor *VD, std::string file, ModelType MT, GeometryPool *pool = nullptr);
+	void initMesh(BaseProject *bp, VertexDescriptor *VD, GeometryPool *pool = nullptr);
+	// init() in two steps: load() only touches the CPU (and can run on any thread), upload() creates
+	// the buffers, or adds the mesh to the pool
+	void load(BaseProject *bp, VertexDescriptor *VD, std::string file, ModelType MT, GeometryPool *pool = nullptr);
+	void upload();
 	void cleanup();
   	void bind(VkCommandBuffer commandBuffer);
+  	void bind(VkCommandBuffer commandBuffer, InstanceBuffer &instances, int currentImage);
 };
 
 struct Texture {
 	BaseProject *BP;
 	uint32_t mipLevels;
 	VkImage textureImage;
-	VkDeviceMemory textureImageMemory;
+	GpuAllocation textureImageMemory;
 	VkImageView textureImageView;
 	VkSampler textureSampler;
 	int imgs;
 	static const int maxImgs = 6;
+
+	// Decoded by load(), released by upload() once copied in the staging buffer
+	stbi_uc *pixels[maxImgs];
+	int texWidth, texHeight;
+	VkFormat format;
+	bool withSampler;
 	
-	void createTextureImage(std::vector<std::string>files, VkFormat Fmt);
+	void decodeImages(std::vector<std::string>files);
+	void createTextureImage(VkFormat Fmt);
 	void createTextureImageView(VkFormat Fmt);
 	void createTextureSampler(VkFilter magFilter,
 							 VkFilter minFilter,
@@ -269,9 +812,112 @@ struct Texture {
 
 	void init(BaseProject *bp, std::string file, VkFormat Fmt, bool initSampler);
 	void initCubic(BaseProject *bp, std::vector<std::string>, VkFormat Fmt);
+	// init() in two steps: load() only touches the CPU (and can run on any thread), upload() creates the image
+	void load(BaseProject *bp, std::string file, VkFormat Fmt, bool initSampler);
+	void upload();
 	void cleanup();
 };
 
+// Runs job(i) for every i < count on a pool of worker threads (the calling one included), and returns
+// when all are done. The first exception thrown by a job is rethrown here, the jobs not started are skipped
+class WorkerPool {
+public:
+	explicit WorkerPool(unsigned threads = 0)
+		: threads(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency())) {}
+
+	unsigned size() const { return threads; }
+
+	void run(size_t count, const std::function<void(size_t)> &job) {
+		std::atomic<size_t> next{0};
+		std::exception_ptr error;
+		std::mutex errorMutex;
+		auto worker = [&]() {
+			for (size_t i = next++; i < count; i = next++) {
+				try {
+					job(i);
+				} catch (...) {
+					std::lock_guard<std::mutex> lock(errorMutex);
+					if (!error) {
+						error = std::current_exception();
+					}
+					next = count;
+				}
+			}
+		};
+
+		std::vector<std::thread> workers;
+		for (size_t t = 1; t < std::min<size_t>(threads, count); t++) {
+			workers.emplace_back(worker);
+		}
+		worker();
+		for (std::thread &w : workers) {
+			w.join();
+		}
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+
+private:
+	unsigned threads;
+};
+
+// Startup loading of models and textures. The CPU work of the queued assets (file read, decryption, inflate,
+// parse, vertex packing, image decode) is spread on a WorkerPool by finish(), the largest files first; the
+// Vulkan uploads follow on the calling thread in the order of the queue, so geometry pools are laid out as with init()
+class AssetLoader {
+public:
+	explicit AssetLoader(unsigned threads = 0) : workers(threads) {}
+
+	void model(Model &M, BaseProject *bp, VertexDescriptor *VD, const std::string &file, ModelType MT, GeometryPool *pool = nullptr) {
+		jobs.push_back({fileSize(file), [=, &M]() { M.load(bp, VD, file, MT, pool); }, [&M]() { M.upload(); }});
+	}
+
+	void texture(Texture &T, BaseProject *bp, const std::string &file, VkFormat Fmt = VK_FORMAT_R8G8B8A8_SRGB, bool initSampler = true) {
+		jobs.push_back({fileSize(file), [=, &T]() { T.load(bp, file, Fmt, initSampler); }, [&T]() { T.upload(); }});
+	}
+
+	void finish() {
+		auto start = std::chrono::steady_clock::now();
+		std::vector<size_t> order(jobs.size());
+		for (size_t i = 0; i < order.size(); i++) {
+			order[i] = i;
+		}
+		std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) { return jobs[a].size > jobs[b].size; });
+		{
+			PROFILE_ZONE("AssetDecode");
+			workers.run(order.size(), [this, &order](size_t i) { jobs[order[i]].load(); });
+		}
+		auto decoded = std::chrono::steady_clock::now();
+		{
+			PROFILE_ZONE("AssetUpload");
+			for (Job &J : jobs) {
+				J.upload();
+			}
+		}
+		auto uploaded = std::chrono::steady_clock::now();
+
+		std::cout << "Loaded " << jobs.size() << " assets: decode "
+				  << std::chrono::duration<float, std::milli>(decoded - start).count() << " ms on "
+				  << workers.size() << " threads, upload "
+				  << std::chrono::duration<float, std::milli>(uploaded - decoded).count() << " ms\n";
+		jobs.clear();
+	}
+
+private:
+	struct Job {
+		uintmax_t size;
+		std::function<void()> load;
+		std::function<void()> upload;
+	};
+	WorkerPool workers;
+	std::vector<Job> jobs;
+
+	static uintmax_t fileSize(const std::string &file) {
+		return assetSize(file);
+	}
+};
+
 struct DescriptorSetLayoutBinding {
 	uint32_t binding;
 	VkDescriptorType type;
@@ -281,11 +927,14 @@ struct DescriptorSetLayoutBinding {
 };
 
 
+// Bindings declared as VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER are created as UNIFORM_BUFFER_DYNAMIC:
+// their data lives in the per-frame uniform ring buffer and is selected with a dynamic offset
 struct DescriptorSetLayout {
 	BaseProject *BP;
  	VkDescriptorSetLayout descriptorSetLayout;
 	std::vector<DescriptorSetLayoutBinding> Bindings;
 	int imgInfoSize;
+	int dynamicCount;
  	
  	void init(BaseProject *bp, std::vector<DescriptorSetLayoutBinding> B);
 	void cleanup();
@@ -316,49 +965,118 @@ struct Pipeline {
   	void destroy();
   	void bind(VkCommandBuffer commandBuffer);
   	
-  	VkShaderModule createShaderModule(const std::vector<char>& code);
+  	VkShaderModule createShaderModule(const Asset& code);
+	void cleanup();
+};
+
+// Buffer owned outside the descriptor sets, so that several sets can point at the same data:
+// a uniform one is a slot of the per-frame ring buffer, a storage one a single static buffer
+struct SharedBuffer {
+	BaseProject *BP;
+	VkDescriptorType type;
+	VkDeviceSize size;
+	VkDeviceSize uniformSlot;
+	VkBuffer storageBuffer;
+	GpuAllocation storageBufferMemory;
+
+	void init(BaseProject *bp, VkDescriptorType type, VkDeviceSize size);
 	void cleanup();
+  	void map(int currentImage, void *src);
+  	void *mapped(int currentImage);
 };
 
 struct DescriptorSet {
 	BaseProject *BP;
 
-	std::vector<std::vector<VkBuffer>> uniformBuffers;
-	std::vector<std::vector<VkDeviceMemory>> uniformBuffersMemory;
-	std::vector<VkDescriptorSet> descriptorSets;
+	// Uniform bindings: offset of the binding inside every frame region of the uniform ring buffer
+	std::vector<VkDeviceSize> uniformSlots;
+	// Storage bindings hold static data: a single buffer shared by all the frames
+	std::vector<VkBuffer> storageBuffers;
+	std::vector<GpuAllocation> storageBuffersMemory;
+	std::vector<VkDeviceSize> bufferSizes;
+	std::vector<uint32_t> dynamicOffsets;
+	VkDescriptorSet descriptorSet;
 	DescriptorSetLayout *Layout;
-	
+
 	std::vector<bool> toFree;
 
+	// For storage buffers linkSize is the size of one element, and elements[j] the number of elements of binding j.
+	// A non null shared[j] makes binding j point at that buffer instead of creating its own
 	void init(BaseProject *bp, DescriptorSetLayout *L,
-						 std::vector<Texture *>Txs);
+						 std::vector<Texture *>Txs, std::vector<int> elements = {},
+						 std::vector<SharedBuffer *> shared = {});
 	void cleanup();
   	void bind(VkCommandBuffer commandBuffer, Pipeline &P, int setId, int currentImage);
   	void map(int currentImage, void *src, int slot);
+  	void *mapped(int currentImage, int slot);
 };
 
 
+struct StagedUpload {
+	VkBuffer stagingBuffer;
+	GpuAllocation stagingBufferMemory;
+	VkBuffer dstBuffer;
+	VkDeviceSize size;
+};
+
 struct PoolSizes {
 	int uniformBlocksInPool = 0;
+	int storageBlocksInPool = 0;
 	int texturesInPool = 0;
 	int setsInPool = 0;
 };
 
+// Turns the variable frame time into a whole number of fixed simulation steps
+struct FixedStepClock {
+	float step = 1.0f / 120.0f;
+	int maxStepsPerFrame = 8;
+	float accumulator = 0.0f;
+
+	// Steps to simulate for a frame that lasted deltaT
+	int advance(float deltaT) {
+		accumulator += deltaT;
+		int steps = std::min(static_cast<int>(accumulator / step), maxStepsPerFrame);
+		accumulator -= steps * step;
+		// After a stall the time that exceeds maxStepsPerFrame is dropped, instead of piling up
+		if (accumulator >= step) {
+			accumulator = std::fmod(accumulator, step);
+		}
+		return steps;
+	}
+
+	// Fraction of a step not simulated yet, to interpolate between the last two states
+	float alpha() const {
+		return accumulator / step;
+	}
+};
+
 // MAIN ! 
 class BaseProject {
 	friend class VertexDescriptor;
 	friend class Model;
+	friend class GeometryPool;
+	friend class DrawList;
 	friend class Texture;
 	friend class Pipeline;
 	friend class DescriptorSetLayout;
 	friend class DescriptorSet;
+	friend class SharedBuffer;
+	friend class InstanceBuffer;
 public:
 	virtual void setWindowParameters() = 0;
     void run() {
+		startTime = std::chrono::steady_clock::now();
     	windowResizable = GLFW_FALSE;
 
+		// Without a pack every asset is read from its loose file
+		if (!assetPackFile.empty() && !assetPack().open(assetPackFile)) {
+			std::cout << "No asset pack, loading the loose files\n";
+		}
+
     	setWindowParameters();
-        initWindow();
+		if (!headless) {
+			initWindow();
+		}
         initVulkan();
         mainLoop();
         cleanup();
@@ -366,6 +1084,53 @@ public:
 
 	PoolSizes DPSZs;
 
+	// Renders frameCount frames (0: until the benchmark ends) into offscreen images without a window
+	// or a surface, then exits. If dumpDir is not empty, every dumpInterval-th frame is saved there as frame_NNNNN.png
+	void setHeadless(uint64_t frameCount, const std::string &dumpDir = "", uint64_t dumpInterval = 1) {
+		headless = true;
+		headlessFrames = frameCount;
+		frameDumpDir = dumpDir;
+		frameDumpInterval = std::max<uint64_t>(dumpInterval, 1);
+	}
+
+	// The simulation advances in fixed steps of 1/stepsPerSecond s, at most maxStepsPerFrame per rendered frame
+	void setSimulationRate(float stepsPerSecond, int maxStepsPerFrame = 8) {
+		simClock.step = 1.0f / stepsPerSecond;
+		simClock.maxStepsPerFrame = std::max(maxStepsPerFrame, 1);
+	}
+
+	// Drives the frames with the input script, and writes the frame time report at exit
+	void setBenchmark(const std::string &scriptPath, const std::string &reportPath) {
+		benchmark.load(scriptPath);
+		benchmarking = true;
+		benchmarkReportPath = reportPath;
+	}
+
+	// Saves the live input at exit, in the format of the benchmark scripts
+	void setInputRecording(const std::string &path) {
+		recordingInput = true;
+		inputRecorder.path = path;
+	}
+
+	// Threads decoding the assets at startup (AssetLoader), 0 for one per core
+	void setLoadThreads(unsigned threads) {
+		loadThreads = threads;
+	}
+
+	// Folder of the mesh cache (MeshCache), empty to load every model from its source
+	void setMeshCacheDir(const std::string &dir) {
+		meshCacheDir = dir;
+	}
+
+	// Asset pack opened at startup (AssetPack), empty to read only the loose files
+	void setAssetPack(const std::string &file) {
+		assetPackFile = file;
+	}
+
+	// Heap allocations of the last frame, and of all the frames after the warm-up (swapchain recreations excluded)
+	uint64_t getLastFrameHeapAllocations() const { return lastFrameHeapAllocations; }
+	uint64_t getSteadyStateHeapAllocations() const { return steadyStateHeapAllocations; }
+
 protected:
 	uint32_t windowWidth;
 	uint32_t windowHeight;
@@ -379,10 +1144,15 @@ protected:
 	VkSurfaceKHR surface;
     VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
     VkDevice device;
+	// multiDrawIndirect and drawIndirectFirstInstance, both enabled: a DrawList is then issued as one indirect draw
+	bool multiDrawIndirect = false;
     VkQueue graphicsQueue;
     VkQueue presentQueue;
 	VkCommandPool commandPool;
 	std::vector<VkCommandBuffer> commandBuffers;
+	// The command buffer of an image is recorded again every frame, after updateUniformBuffer(), instead of
+	// once per swapchain: for draws that change every frame (culling). To be set before initVulkan()
+	bool recordEveryFrame = false;
 
     VkSwapchainKHR swapChain;
     std::vector<VkImage> swapChainImages;
@@ -397,12 +1167,12 @@ protected:
 	VkDebugUtilsMessengerEXT debugMessenger;
 	
 	VkImage depthImage;
-	VkDeviceMemory depthImageMemory;
+	GpuAllocation depthImageMemory;
 	VkImageView depthImageView;
 
 	VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
 	VkImage colorImage;
-	VkDeviceMemory colorImageMemory;
+	GpuAllocation colorImageMemory;
 	VkImageView colorImageView;
 
 	std::vector<VkFramebuffer> swapChainFramebuffers;
@@ -413,6 +1183,56 @@ protected:
 	std::vector<VkSemaphore> renderFinishedSemaphores;
 	std::vector<VkFence> inFlightFences;
 	std::vector<VkFence> imagesInFlight;
+
+	// Device local buffers waiting for their staging copy
+	std::vector<StagedUpload> pendingUploads;
+
+	// Every buffer and image memory is sub-allocated from here
+	GpuMemoryAllocator gpuAllocator;
+
+	// Per-frame uniform data: one buffer with a region per swapchain image. Descriptor sets reserve
+	// a slot at init, and select the region of the frame with a dynamic offset when bound
+	VkDeviceSize uniformRingFrameCapacity = 64 * 1024;
+	VkBuffer uniformRingBuffer;
+	GpuAllocation uniformRingMemory;
+	VkDeviceSize uniformRingAlignment = 256;
+	VkDeviceSize uniformRingFrameSize = 0;
+	VkDeviceSize uniformRingHead = 0;
+
+	// Frame allocation tracking
+	const uint64_t warmUpFrames = 60;
+	uint64_t frameCount = 0;
+	uint64_t swapChainRecreations = 0;
+	uint64_t lastFrameHeapAllocations = 0;
+	uint64_t steadyStateHeapAllocations = 0;
+
+	// Headless mode: the swapchain images are replaced by offscreen color images
+	bool headless = false;
+	uint64_t headlessFrames = 0;
+	std::string frameDumpDir;
+	uint64_t frameDumpInterval = 1;
+	std::vector<GpuAllocation> offscreenImagesMemory;
+
+	// Fixed-step simulation clock, fed with the deltaT of every frame by the application
+	FixedStepClock simClock;
+
+	// Startup: threads of the AssetLoader, and start of run() for the time to the first frame
+	unsigned loadThreads = 0;
+	std::chrono::steady_clock::time_point startTime;
+	std::string meshCacheDir = "cache/meshes";
+	std::string assetPackFile = "assets.pack";
+
+	// Scripted benchmark and input recording
+	bool benchmarking = false;
+	Benchmark benchmark;
+	std::string benchmarkReportPath;
+	bool recordingInput = false;
+	BenchmarkRecorder inputRecorder;
+
+	// GPU frame time: a timestamp before and after the commands of each image (benchmark only)
+	VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+	float timestampPeriod = 1.0f;
+	std::vector<int64_t> timestampFrames;	// frame that wrote the pending timestamps of each image, -1 if none
 	
     void initWindow() {
         glfwInit();
@@ -446,6 +1266,7 @@ protected:
 		createSurface();				
 		pickPhysicalDevice();			
 		createLogicalDevice();			
+		gpuAllocator.init(physicalDevice, device);
 		createSwapChain();				
 		createImageViews();				
 		createRenderPass();			
@@ -454,10 +1275,14 @@ protected:
 		createDepthResources();			
 		createFramebuffers();			
 		localInit();
+		flushStagedUploads();
+		gpuAllocator.printStats();
 
+		createUniformRing();
 		createDescriptorPool();			
 		pipelinesAndDescriptorSetsInit();
 
+		createTimestampQueries();
 		createCommandBuffers();			
 		createSyncObjects();			 
     }
@@ -476,13 +1301,6 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 		createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 		createInfo.pApplicationInfo = &appInfo;
 
-		uint32_t glfwExtensionCount = 0;
-		const char** glfwExtensions;
-		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-				
-//		createInfo.enabledExtensionCount = glfwExtensionCount;
-//		createInfo.ppEnabledExtensionNames = glfwExtensions;
-
 		createInfo.enabledLayerCount = 0;
 
 		auto extensions = getRequiredExtensions();
@@ -514,13 +1332,14 @@ std::cout << "Starting createInstance()\n"  << std::flush;
     }
     
     std::vector<const char*> getRequiredExtensions() {
-		uint32_t glfwExtensionCount = 0;
-		const char** glfwExtensions;
-		glfwExtensions =
-			glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-		std::vector<const char*> extensions(glfwExtensions,
-			glfwExtensions + glfwExtensionCount);
+		std::vector<const char*> extensions;
+		if (!headless) {
+			uint32_t glfwExtensionCount = 0;
+			const char** glfwExtensions;
+			glfwExtensions =
+				glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+			extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+		}
 			
 		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);		
 		
@@ -635,6 +1454,10 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 	}
 
     void createSurface() {
+		if (headless) {
+			surface = VK_NULL_HANDLE;
+			return;
+		}
     	if (glfwCreateWindowSurface(instance, window, nullptr, &surface)
     			!= VK_SUCCESS) {
 			throw std::runtime_error("failed to create window surface!");
@@ -678,6 +1501,12 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 		vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 		
 		std::cout << "Physical devices found: " << deviceCount << "\n";
+
+		// Nothing is presented, so the swapchain extension is not required
+		if (headless) {
+			deviceExtensions.erase(std::remove(deviceExtensions.begin(), deviceExtensions.end(),
+								   std::string(VK_KHR_SWAPCHAIN_EXTENSION_NAME)), deviceExtensions.end());
+		}
 		
 		for (const auto& device : devices) {
 			if(checkIfItHasDeviceExtension(device, "VK_KHR_portability_subset")) {
@@ -706,8 +1535,8 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 
 		devRep.extensionsSupported = checkDeviceExtensionSupport(device, devRep);
 
-		devRep.swapChainAdequate = false;
-		if (devRep.extensionsSupported) {
+		devRep.swapChainAdequate = headless;
+		if (devRep.extensionsSupported && !headless) {
 			SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
 			devRep.swapChainFormatSupport = swapChainSupport.formats.empty();
 			devRep.swapChainPresentModeSupport = swapChainSupport.presentModes.empty();
@@ -743,8 +1572,13 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 			}
 				
 			VkBool32 presentSupport = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
-												 &presentSupport);
+			if (headless) {
+				// The graphics queue also copies the frames to be dumped
+				presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+			} else {
+				vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
+													 &presentSupport);
+			}
 			if (presentSupport) {
 			 	indices.presentFamily = i;
 			}
@@ -846,6 +1680,13 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 		deviceFeatures.samplerAnisotropy = VK_TRUE;
 		deviceFeatures.sampleRateShading = VK_TRUE;
 		deviceFeatures.fillModeNonSolid  = VK_TRUE;
+
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+		multiDrawIndirect = supportedFeatures.multiDrawIndirect && supportedFeatures.drawIndirectFirstInstance;
+		deviceFeatures.multiDrawIndirect = multiDrawIndirect ? VK_TRUE : VK_FALSE;
+		deviceFeatures.drawIndirectFirstInstance = multiDrawIndirect ? VK_TRUE : VK_FALSE;
+		std::cout << "Multi draw indirect: " << (multiDrawIndirect ? "yes" : "no, one draw per command") << "\n";
 		
 		VkDeviceCreateInfo createInfo{};
 		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -875,6 +1716,10 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 	}
 	
 	void createSwapChain() {
+		if (headless) {
+			createOffscreenTargets();
+			return;
+		}
 		SwapChainSupportDetails swapChainSupport =
 				querySwapChainSupport(physicalDevice);
 		VkSurfaceFormatKHR surfaceFormat =
@@ -935,6 +1780,27 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 		swapChainExtent = extent;
 	}
 
+	// Same role as the swapchain images, one per frame in flight
+	void createOffscreenTargets() {
+		swapChainImageFormat = VK_FORMAT_R8G8B8A8_SRGB;
+		swapChainExtent = {windowWidth, windowHeight};
+		swapChainImages.resize(MAX_FRAMES_IN_FLIGHT);
+		offscreenImagesMemory.resize(MAX_FRAMES_IN_FLIGHT);
+		for (size_t i = 0; i < swapChainImages.size(); i++) {
+			createImage(swapChainExtent.width, swapChainExtent.height, 1, 1,
+						VK_SAMPLE_COUNT_1_BIT, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+						VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+						VK_IMAGE_USAGE_TRANSFER_SRC_BIT, 0,
+						VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+						swapChainImages[i], offscreenImagesMemory[i]);
+		}
+	}
+
+	// Layout of the color images at the end of the render pass
+	VkImageLayout finalColorLayout() {
+		return headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	}
+
 	VkSurfaceFormatKHR chooseSwapSurfaceFormat(
 				const std::vector<VkSurfaceFormatKHR>& availableFormats)
 	{
@@ -1022,7 +1888,7 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 		colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 		colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		colorAttachmentResolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		colorAttachmentResolve.finalLayout = finalColorLayout();
 
 		VkAttachmentReference colorAttachmentResolveRef{};
 		colorAttachmentResolveRef.attachment = 2;
@@ -1132,7 +1998,7 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 		VkCommandPoolCreateInfo poolInfo{};
 		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-		poolInfo.flags = 0; // Optional
+		poolInfo.flags = recordEveryFrame ? VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT : 0;
 		
 		VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
 		if (result != VK_SUCCESS) {
@@ -1208,7 +2074,7 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 				 	 VkImageTiling tiling, VkImageUsageFlags usage,
 				 	 VkImageCreateFlags cflags,
 				 	 VkMemoryPropertyFlags properties, VkImage& image,
-				 	 VkDeviceMemory& imageMemory) {		
+				 	 GpuAllocation& imageMemory) {		
 		VkImageCreateInfo imageInfo{};
 		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 		imageInfo.imageType = VK_IMAGE_TYPE_2D;
@@ -1234,17 +2100,15 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 		VkMemoryRequirements memRequirements;
 		vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size;
-		allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits,
-											properties);
-		if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) !=
-								VK_SUCCESS) {
-			throw std::runtime_error("failed to allocate image memory!");
-		}
+		imageMemory = gpuAllocator.allocate(memRequirements, properties,
+											tiling == VK_IMAGE_TILING_OPTIMAL,
+											GPU_MEMORY_PERSISTENT);
+		vkBindImageMemory(device, image, imageMemory.memory, imageMemory.offset);
+	}
 
-		vkBindImageMemory(device, image, imageMemory, 0);
+	void destroyImage(VkImage image, GpuAllocation& imageMemory) {
+		vkDestroyImage(device, image, nullptr);
+		gpuAllocator.release(imageMemory);
 	}
 
 	void generateMipmaps(VkImage image, VkFormat imageFormat,
@@ -1448,9 +2312,49 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 		vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
 	}
 	
+	// Creates a DEVICE_LOCAL buffer and queues the copy of data into it: the copy is done by flushStagedUploads()
+	void createDeviceLocalBuffer(const void *data, VkDeviceSize size, VkBufferUsageFlags usage,
+								 VkBuffer& buffer, GpuAllocation& bufferMemory) {
+		StagedUpload upload{};
+		upload.size = size;
+		createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+					 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+					 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					 upload.stagingBuffer, upload.stagingBufferMemory,
+					 GPU_MEMORY_TRANSIENT);
+		memcpy(upload.stagingBufferMemory.mapped, data, (size_t) size);
+
+		createBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+					 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufferMemory);
+		upload.dstBuffer = buffer;
+		pendingUploads.push_back(upload);
+	}
+
+	// Records every pending staging copy in one command buffer, submits it once and frees the staging buffers
+	void flushStagedUploads() {
+		if (pendingUploads.empty()) {
+			return;
+		}
+
+		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+		for (const StagedUpload &upload : pendingUploads) {
+			VkBufferCopy copyRegion{};
+			copyRegion.size = upload.size;
+			vkCmdCopyBuffer(commandBuffer, upload.stagingBuffer, upload.dstBuffer, 1, &copyRegion);
+		}
+		endSingleTimeCommands(commandBuffer);
+
+		for (StagedUpload &upload : pendingUploads) {
+			destroyBuffer(upload.stagingBuffer, upload.stagingBufferMemory);
+		}
+		std::cout << "Uploaded " << pendingUploads.size() << " buffers in a single submission\n";
+		pendingUploads.clear();
+	}
+
 	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
 					  VkMemoryPropertyFlags properties,
-					  VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+					  VkBuffer& buffer, GpuAllocation& bufferMemory,
+					  GpuMemoryLifetime lifetime = GPU_MEMORY_PERSISTENT) {
 		VkBufferCreateInfo bufferInfo{};
 		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 		bufferInfo.size = size;
@@ -1467,52 +2371,70 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 		VkMemoryRequirements memRequirements;
 		vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
 		
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size;
-		allocInfo.memoryTypeIndex =
-				findMemoryType(memRequirements.memoryTypeBits, properties);
+		bufferMemory = gpuAllocator.allocate(memRequirements, properties, false, lifetime);
+		vkBindBufferMemory(device, buffer, bufferMemory.memory, bufferMemory.offset);
+	}
 
-		result = vkAllocateMemory(device, &allocInfo, nullptr,
-				&bufferMemory);
-		if (result != VK_SUCCESS) {
-		 	PrintVkError(result);
-			throw std::runtime_error("failed to allocate vertex buffer memory!");
-		}
-		
-		vkBindBufferMemory(device, buffer, bufferMemory, 0);	
+	void destroyBuffer(VkBuffer buffer, GpuAllocation& bufferMemory) {
+		vkDestroyBuffer(device, buffer, nullptr);
+		gpuAllocator.release(bufferMemory);
 	}
 	
 	uint32_t findMemoryType(uint32_t typeFilter,
 							VkMemoryPropertyFlags properties) {
-		 VkPhysicalDeviceMemoryProperties memProperties;
-		 vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-		 
-		 for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-		 	if ((typeFilter & (1 << i)) && 
-		 		(memProperties.memoryTypes[i].propertyFlags & properties) ==
-		 				properties) {
-				return i;
-			}
-		}
-		
-		throw std::runtime_error("failed to find suitable memory type!");
+		return gpuAllocator.findMemoryType(typeFilter, properties);
 	}
     
+	// Sized for one frame region per swapchain image, the slots are reserved again when the ring is recreated
+	void createUniformRing() {
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		uniformRingAlignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 1);
+		uniformRingFrameSize = (uniformRingFrameCapacity + uniformRingAlignment - 1) /
+							   uniformRingAlignment * uniformRingAlignment;
+		uniformRingHead = 0;
+
+		createBuffer(uniformRingFrameSize * swapChainImages.size(),
+					 VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+					 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+					 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					 uniformRingBuffer, uniformRingMemory);
+	}
+
+	VkDeviceSize reserveUniformSlot(VkDeviceSize size) {
+		VkDeviceSize slot = uniformRingHead;
+		uniformRingHead += (size + uniformRingAlignment - 1) / uniformRingAlignment * uniformRingAlignment;
+		if (uniformRingHead > uniformRingFrameSize) {
+			throw std::runtime_error("uniform ring buffer is full!");
+		}
+		return slot;
+	}
+
+	uint32_t uniformFrameOffset(int currentImage) {
+		return static_cast<uint32_t>(uniformRingFrameSize * currentImage);
+	}
+
+	void *uniformFrameData(int currentImage, VkDeviceSize slot) {
+		return static_cast<char *>(uniformRingMemory.mapped) + uniformFrameOffset(currentImage) + slot;
+	}
+
+	// Descriptor sets are shared by all the frames: only the dynamic offsets change with the swapchain image
 	void createDescriptorPool() {
-		std::array<VkDescriptorPoolSize, 2> poolSizes{};
-		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		poolSizes[0].descriptorCount = static_cast<uint32_t>(DPSZs.uniformBlocksInPool *
-															 swapChainImages.size());
+		std::vector<VkDescriptorPoolSize> poolSizes(2);
+		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		poolSizes[0].descriptorCount = static_cast<uint32_t>(DPSZs.uniformBlocksInPool);
 		poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		poolSizes[1].descriptorCount = static_cast<uint32_t>(DPSZs.texturesInPool *
-															 swapChainImages.size());
-															 
+		poolSizes[1].descriptorCount = static_cast<uint32_t>(DPSZs.texturesInPool);
+		if (DPSZs.storageBlocksInPool > 0) {
+			poolSizes.push_back({ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+								  static_cast<uint32_t>(DPSZs.storageBlocksInPool) });
+		}
+
 		VkDescriptorPoolCreateInfo poolInfo{};
 		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());;
 		poolInfo.pPoolSizes = poolSizes.data();
-		poolInfo.maxSets = static_cast<uint32_t>(DPSZs.setsInPool * swapChainImages.size());
+		poolInfo.maxSets = static_cast<uint32_t>(DPSZs.setsInPool);
 		
 		VkResult result = vkCreateDescriptorPool(device, &poolInfo, nullptr,
 									&descriptorPool);
@@ -1524,6 +2446,52 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 	
 	virtual void populateCommandBuffer(VkCommandBuffer commandBuffer, int i) = 0;
 
+	void createTimestampQueries() {
+		timestampFrames.assign(swapChainImages.size(), -1);
+		if (!benchmarking) {
+			return;
+		}
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+		uint32_t queueFamilyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
+								queueFamilies.data());
+		if (queueFamilies[indices.graphicsFamily.value()].timestampValidBits == 0) {
+			std::cout << "GPU timestamps not supported: the benchmark reports only the CPU frame time\n";
+			return;
+		}
+		timestampPeriod = properties.limits.timestampPeriod;
+
+		VkQueryPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		poolInfo.queryCount = static_cast<uint32_t>(2 * swapChainImages.size());
+
+		VkResult result = vkCreateQueryPool(device, &poolInfo, nullptr, &timestampQueryPool);
+		if (result != VK_SUCCESS) {
+		 	PrintVkError(result);
+			throw std::runtime_error("failed to create timestamp query pool!");
+		}
+	}
+
+	// Reads the timestamps of the last submission of an image, which must have completed
+	void collectGpuFrameTime(uint32_t imageIndex) {
+		if (timestampQueryPool == VK_NULL_HANDLE || timestampFrames[imageIndex] < 0) {
+			return;
+		}
+		uint64_t timestamps[2];
+		if (vkGetQueryPoolResults(device, timestampQueryPool, 2 * imageIndex, 2, sizeof(timestamps),
+								  timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+			benchmark.addGpuFrame(timestampFrames[imageIndex],
+								  (timestamps[1] - timestamps[0]) * timestampPeriod / 1.0e6f);
+		}
+		timestampFrames[imageIndex] = -1;
+	}
+
     void createCommandBuffers() {
     	commandBuffers.resize(swapChainFramebuffers.size());
     	
@@ -1540,46 +2508,74 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 			throw std::runtime_error("failed to allocate command buffers!");
 		}
 		
-		for (size_t i = 0; i < commandBuffers.size(); i++) {
-			VkCommandBufferBeginInfo beginInfo{};
-			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			beginInfo.flags = 0; // Optional
-			beginInfo.pInheritanceInfo = nullptr; // Optional
-
-			if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) !=
-						VK_SUCCESS) {
-				throw std::runtime_error("failed to begin recording command buffer!");
+		// Otherwise recorded by drawFrame(), every frame
+		if (!recordEveryFrame) {
+			for (size_t i = 0; i < commandBuffers.size(); i++) {
+				recordCommandBuffer(static_cast<uint32_t>(i));
 			}
-			
-			VkRenderPassBeginInfo renderPassInfo{};
-			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			renderPassInfo.renderPass = renderPass; 
-			renderPassInfo.framebuffer = swapChainFramebuffers[i];
-			renderPassInfo.renderArea.offset = {0, 0};
-			renderPassInfo.renderArea.extent = swapChainExtent;
-	
-			std::array<VkClearValue, 2> clearValues{};
-			clearValues[0].color = initialBackgroundColor;
-			clearValues[1].depthStencil = {1.0f, 0};
-	
-			renderPassInfo.clearValueCount =
-							static_cast<uint32_t>(clearValues.size());
-			renderPassInfo.pClearValues = clearValues.data();
-			
-			vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo,
-					VK_SUBPASS_CONTENTS_INLINE);			
-	
+		}
+	}
 
-			populateCommandBuffer(commandBuffers[i], i);
-			
+	void recordCommandBuffer(uint32_t i) {
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = recordEveryFrame ? VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT : 0;
+		beginInfo.pInheritanceInfo = nullptr; // Optional
 
-			vkCmdEndRenderPass(commandBuffers[i]);
+		if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) !=
+					VK_SUCCESS) {
+			throw std::runtime_error("failed to begin recording command buffer!");
+		}
 
-			if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-				throw std::runtime_error("failed to record command buffer!");
-			}
+		if (timestampQueryPool != VK_NULL_HANDLE) {
+			vkCmdResetQueryPool(commandBuffers[i], timestampQueryPool, 2 * i, 2);
+			vkCmdWriteTimestamp(commandBuffers[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+								timestampQueryPool, 2 * i);
+		}
+		
+		VkRenderPassBeginInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = renderPass; 
+		renderPassInfo.framebuffer = swapChainFramebuffers[i];
+		renderPassInfo.renderArea.offset = {0, 0};
+		renderPassInfo.renderArea.extent = swapChainExtent;
+
+		std::array<VkClearValue, 2> clearValues{};
+		clearValues[0].color = initialBackgroundColor;
+		clearValues[1].depthStencil = {1.0f, 0};
+
+		renderPassInfo.clearValueCount =
+						static_cast<uint32_t>(clearValues.size());
+		renderPassInfo.pClearValues = clearValues.data();
+		
+		vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo,
+				VK_SUBPASS_CONTENTS_INLINE);			
+
+
+		populateCommandBuffer(commandBuffers[i], i);
+		
+
+		vkCmdEndRenderPass(commandBuffers[i]);
+
+		if (timestampQueryPool != VK_NULL_HANDLE) {
+			vkCmdWriteTimestamp(commandBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+								timestampQueryPool, 2 * i + 1);
+		}
+
+		if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record command buffer!");
 		}
 	}
+
+	// The previous submission of the image must have completed
+	void reRecordCommandBuffer(uint32_t imageIndex) {
+		if (!recordEveryFrame) {
+			return;
+		}
+		PROFILE_ZONE("RecordCommandBuffer");
+		vkResetCommandBuffer(commandBuffers[imageIndex], 0);
+		recordCommandBuffer(imageIndex);
+	}
     
     void createSyncObjects() {
     	imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
@@ -1612,23 +2608,80 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 		}
 	}
 	
+	bool keepRunning() {
+		if (benchmarking && frameCount >= benchmark.frames) {
+			return false;
+		}
+		if (headless) {
+			return headlessFrames == 0 ? benchmarking : frameCount < headlessFrames;
+		}
+		return !glfwWindowShouldClose(window);
+	}
+
     void mainLoop() {
-        while (!glfwWindowShouldClose(window)){
-            glfwPollEvents();
+        while (keepRunning()){
+			if (!headless) {
+				glfwPollEvents();
+			}
+
+			auto frameStart = std::chrono::steady_clock::now();
+			uint64_t allocationsBefore = heapAllocationCount.load(std::memory_order_relaxed);
+			uint64_t recreationsBefore = swapChainRecreations;
             drawFrame();
+			Profiler::endFrame();
+			if (frameCount == 0) {
+				std::cout << "First frame after " << std::chrono::duration<float, std::milli>
+							 (std::chrono::steady_clock::now() - startTime).count() << " ms\n";
+			}
+			if (benchmarking) {
+				benchmark.addCpuFrame(frameCount, std::chrono::duration<float, std::milli>
+									  (std::chrono::steady_clock::now() - frameStart).count());
+			}
+			lastFrameHeapAllocations = heapAllocationCount.load(std::memory_order_relaxed) - allocationsBefore;
+			if (++frameCount > warmUpFrames && swapChainRecreations == recreationsBefore) {
+				steadyStateHeapAllocations += lastFrameHeapAllocations;
+			}
         }
         
         vkDeviceWaitIdle(device);
+
+		std::cout << "Heap allocations after warm-up: " << steadyStateHeapAllocations
+				  << " over " << (frameCount > warmUpFrames ? frameCount - warmUpFrames : 0) << " frames\n";
+
+		if (benchmarking) {
+			for (uint32_t i = 0; i < timestampFrames.size(); i++) {
+				collectGpuFrameTime(i);
+			}
+			benchmark.writeReport(benchmarkReportPath, timestampQueryPool != VK_NULL_HANDLE);
+		}
+		if (recordingInput) {
+			inputRecorder.save();
+		}
     }
     
     void drawFrame() {
-		vkWaitForFences(device, 1, &inFlightFences[currentFrame],
-						VK_TRUE, UINT64_MAX);
+		PROFILE_ZONE("drawFrame");
+		flushStagedUploads();	// geometry created after localInit()
+
+		{
+			PROFILE_ZONE("WaitFrameFence");
+			vkWaitForFences(device, 1, &inFlightFences[currentFrame],
+							VK_TRUE, UINT64_MAX);
+		}
 		
+		if (headless) {
+			drawOffscreenFrame();
+			return;
+		}
+
 		uint32_t imageIndex;
 		
-		VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX,
-				imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+		VkResult result;
+		{
+			PROFILE_ZONE("AcquireNextImage");
+			result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX,
+					imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+		}
 
 		if (result == VK_ERROR_OUT_OF_DATE_KHR) {
 			recreateSwapChain();
@@ -1638,12 +2691,18 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 		}
 
 		if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
+			PROFILE_ZONE("WaitImageFence");
 			vkWaitForFences(device, 1, &imagesInFlight[imageIndex],
 							VK_TRUE, UINT64_MAX);
 		}
 		imagesInFlight[imageIndex] = inFlightFences[currentFrame];
+		collectGpuFrameTime(imageIndex);
 		
-		updateUniformBuffer(imageIndex);
+		{
+			PROFILE_ZONE("updateUniformBuffer");
+			updateUniformBuffer(imageIndex);
+		}
+		reRecordCommandBuffer(imageIndex);
 		
 		VkSubmitInfo submitInfo{};
 		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -1661,9 +2720,15 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 		
 		vkResetFences(device, 1, &inFlightFences[currentFrame]);
 
-		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo,
-				inFlightFences[currentFrame]) != VK_SUCCESS) {
-			throw std::runtime_error("failed to submit draw command buffer!");
+		{
+			PROFILE_ZONE("QueueSubmit");
+			if (vkQueueSubmit(graphicsQueue, 1, &submitInfo,
+					inFlightFences[currentFrame]) != VK_SUCCESS) {
+				throw std::runtime_error("failed to submit draw command buffer!");
+			}
+		}
+		if (timestampQueryPool != VK_NULL_HANDLE) {
+			timestampFrames[imageIndex] = frameCount;
 		}
 		
 		VkPresentInfoKHR presentInfo{};
@@ -1677,7 +2742,10 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 		presentInfo.pImageIndices = &imageIndex;
 		presentInfo.pResults = nullptr; // Optional
 		
-		result = vkQueuePresentKHR(presentQueue, &presentInfo);
+		{
+			PROFILE_ZONE("QueuePresent");
+			result = vkQueuePresentKHR(presentQueue, &presentInfo);
+		}
 
 		if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR ||
 			framebufferResized) {
@@ -1690,6 +2758,53 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 		currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
     }
 
+	// Headless counterpart of the second half of drawFrame(): no acquire and no present,
+	// image i is only used by frame in flight i
+	void drawOffscreenFrame() {
+		uint32_t imageIndex = static_cast<uint32_t>(currentFrame);
+		collectGpuFrameTime(imageIndex);
+		
+		{
+			PROFILE_ZONE("updateUniformBuffer");
+			updateUniformBuffer(imageIndex);
+		}
+		reRecordCommandBuffer(imageIndex);
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+
+		vkResetFences(device, 1, &inFlightFences[currentFrame]);
+
+		{
+			PROFILE_ZONE("QueueSubmit");
+			if (vkQueueSubmit(graphicsQueue, 1, &submitInfo,
+					inFlightFences[currentFrame]) != VK_SUCCESS) {
+				throw std::runtime_error("failed to submit draw command buffer!");
+			}
+		}
+		if (timestampQueryPool != VK_NULL_HANDLE) {
+			timestampFrames[imageIndex] = frameCount;
+		}
+
+		if (!frameDumpDir.empty() && frameCount % frameDumpInterval == 0) {
+			PROFILE_ZONE("FrameDump");
+			vkWaitForFences(device, 1, &inFlightFences[currentFrame],
+							VK_TRUE, UINT64_MAX);
+			char name[32];
+			snprintf(name, sizeof(name), "/frame_%05llu.png", (unsigned long long)frameCount);
+			saveScreenshot((frameDumpDir + name).c_str(), imageIndex);
+		}
+
+		if (framebufferResized) {
+			framebufferResized = false;
+			recreateSwapChain();
+		}
+
+		currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+	}
+
 	virtual void updateUniformBuffer(uint32_t currentImage) = 0;
 
 	virtual void pipelinesAndDescriptorSetsCleanup() = 0;
@@ -1697,14 +2812,17 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 	
     void recreateSwapChain() {
     	int width = 0, height = 0;
-		glfwGetFramebufferSize(window, &width, &height);
-		
-		while (width == 0 || height == 0) {
+		if (!headless) {
 			glfwGetFramebufferSize(window, &width, &height);
-			glfwWaitEvents();
+			
+			while (width == 0 || height == 0) {
+				glfwGetFramebufferSize(window, &width, &height);
+				glfwWaitEvents();
+			}
 		}
 
 		vkDeviceWaitIdle(device);
+		swapChainRecreations++;
     	
     	cleanupSwapChain();
 
@@ -1714,21 +2832,21 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 		createColorResources();
 		createDepthResources();
 		createFramebuffers();
+		createUniformRing();
 		createDescriptorPool();
 
 		pipelinesAndDescriptorSetsInit();
 
+		createTimestampQueries();
 		createCommandBuffers();
 	}
 
 	void cleanupSwapChain() {
     	vkDestroyImageView(device, colorImageView, nullptr);
-    	vkDestroyImage(device, colorImage, nullptr);
-    	vkFreeMemory(device, colorImageMemory, nullptr);
+    	destroyImage(colorImage, colorImageMemory);
     	
 		vkDestroyImageView(device, depthImageView, nullptr);
-		vkDestroyImage(device, depthImage, nullptr);
-		vkFreeMemory(device, depthImageMemory, nullptr);
+		destroyImage(depthImage, depthImageMemory);
 
 		for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
 			vkDestroyFramebuffer(device, swapChainFramebuffers[i], nullptr);
@@ -1745,9 +2863,21 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 			vkDestroyImageView(device, swapChainImageViews[i], nullptr);
 		}
 		
-		vkDestroySwapchainKHR(device, swapChain, nullptr);
+		if (headless) {
+			for (size_t i = 0; i < swapChainImages.size(); i++) {
+				destroyImage(swapChainImages[i], offscreenImagesMemory[i]);
+			}
+		} else {
+			vkDestroySwapchainKHR(device, swapChain, nullptr);
+		}
 
 		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+		destroyBuffer(uniformRingBuffer, uniformRingMemory);
+
+		if (timestampQueryPool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(device, timestampQueryPool, nullptr);
+			timestampQueryPool = VK_NULL_HANDLE;
+		}
 	}
 		
     void cleanup() {
@@ -1763,16 +2893,22 @@ std::cout << "Starting createInstance()\n"  << std::flush;
     	
     	vkDestroyCommandPool(device, commandPool, nullptr);
     	
+		gpuAllocator.printStats();
+		gpuAllocator.cleanup();
  		vkDestroyDevice(device, nullptr);
 		
 		DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
 		
-		vkDestroySurfaceKHR(instance, surface, nullptr);
+		if (!headless) {
+			vkDestroySurfaceKHR(instance, surface, nullptr);
+		}
     	vkDestroyInstance(instance, nullptr);
 
-        glfwDestroyWindow(window);
+		if (!headless) {
+			glfwDestroyWindow(window);
 
-        glfwTerminate();
+			glfwTerminate();
+		}
     }
 	
 	void RebuildPipeline() {
@@ -1817,6 +2953,7 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 					glm::vec3 &m,
 					glm::vec3 &r,
 					bool &fire) {
+		PROFILE_ZONE("getSixAxis");
 						
 		static auto startTime = std::chrono::high_resolution_clock::now();
 		static float lastTime = 0.0f;
@@ -1827,6 +2964,21 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 		deltaT = time - lastTime;
 		lastTime = time;
 
+		// Scripted input, with a fixed time step
+		if (benchmarking) {
+			BenchmarkInput in = benchmark.input(frameCount);
+			deltaT = benchmark.deltaT;
+			m = in.m;
+			r = in.r;
+			fire = in.fire;
+			return;
+		}
+
+		// No window to read the input from
+		if (headless) {
+			return;
+		}
+
 		static double old_xpos = 0, old_ypos = 0;
 		double xpos, ypos;
 		glfwGetCursorPos(window, &xpos, &ypos);
@@ -1884,6 +3036,15 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 		handleGamePad(GLFW_JOYSTICK_2,m,r,fire);
 		handleGamePad(GLFW_JOYSTICK_3,m,r,fire);
 		handleGamePad(GLFW_JOYSTICK_4,m,r,fire);
+
+		if (recordingInput) {
+			inputRecorder.add(deltaT, m, r, fire);
+		}
+	}
+
+	// Keyboard state for the application, never pressed when the input is scripted or there is no window
+	bool isKeyPressed(int key) {
+		return !headless && !benchmarking && glfwGetKey(window, key) == GLFW_PRESS;
 	}
 	
 	// Public part of the base class
@@ -2176,7 +3337,7 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 			srcImage,
 			VK_ACCESS_MEMORY_READ_BIT,
 			VK_ACCESS_TRANSFER_READ_BIT,
-			VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+			finalColorLayout(),
 			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
 			VK_PIPELINE_STAGE_TRANSFER_BIT,
 			VK_PIPELINE_STAGE_TRANSFER_BIT,
@@ -2247,7 +3408,7 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 			VK_ACCESS_TRANSFER_READ_BIT,
 			VK_ACCESS_MEMORY_READ_BIT,
 			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-			VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+			finalColorLayout(),
 			VK_PIPELINE_STAGE_TRANSFER_BIT,
 			VK_PIPELINE_STAGE_TRANSFER_BIT,
 			VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
@@ -2365,9 +3526,21 @@ void VertexDescriptor::init(BaseProject *bp, std::vector<VertexBindingDescriptor
 	UV.hasIt = false; UV.offset = 0;
 	Color.hasIt = false; Color.offset = 0;
 	Tangent.hasIt = false; Tangent.offset = 0;
-	
-	if(B.size() == 1) {	// for now, read models only with every vertex information in a single binding
+
+	// The models are read in the single per-vertex binding, any other binding must be per-instance
+	int meshBindings = 0;
+	for(int i = 0; i < B.size(); i++) {
+		if(B[i].inputRate == VK_VERTEX_INPUT_RATE_VERTEX) {
+			meshBinding = B[i].binding;
+			meshStride = B[i].stride;
+			meshBindings++;
+		}
+	}
+	if(meshBindings == 1) {
 		for(int i = 0; i < E.size(); i++) {
+			if(E[i].binding != meshBinding) {
+				continue;
+			}
 			switch(E[i].usage) {
 			  case VertexDescriptorElementUsage::POSITION:
 			    if(E[i].format == VK_FORMAT_R32G32B32_SFLOAT) {
@@ -2434,7 +3607,7 @@ void VertexDescriptor::init(BaseProject *bp, std::vector<VertexBindingDescriptor
 			}
 		}
 	} else {
-		throw std::runtime_error("Vertex format with more than one binding is not supported yet\n");
+		throw std::runtime_error("Vertex format needs exactly one per-vertex binding\n");
 	}
 }
 
@@ -2470,81 +3643,146 @@ std::vector<VkVertexInputAttributeDescription> VertexDescriptor::getAttributeDes
 void Model::loadModelOBJ(std::string file) {
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
+	parseOBJ(file, attrib, shapes);
+	packOBJ(attrib, shapes);
+
+	std::cout << "[OBJ] Vertices: "<< (vertices.size()/VD->meshStride);
+	std::cout << " Indices: "<< indices.size() << "\n";
+}
+
+void Model::parseOBJ(const std::string &file, tinyobj::attrib_t &attrib, std::vector<tinyobj::shape_t> &shapes) {
 	std::vector<tinyobj::material_t> materials;
 	std::string warn, err;
 	
 	std::cout << "Loading : " << file << "[OBJ]\n";	
+	Asset source = readAsset(file);
+	AssetStreamBuf sourceBuf(source);
+	std::istream sourceStream(&sourceBuf);
 	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err,
-						  file.c_str())) {
+						  &sourceStream)) {
 		throw std::runtime_error(warn + err);
 	}
-	
-//	std::cout << "Building\n";	
-//	std::cout << "Position " << VD->Position.hasIt << "," << VD->Position.offset << "\n";	
-//	std::cout << "UV " << VD->UV.hasIt << "," << VD->UV.offset << "\n";	
-//	std::cout << "Normal " << VD->Normal.hasIt << "," << VD->Normal.offset << "\n";
-	int mainStride = VD->Bindings[0].stride;
+}
+
+// One vertex per index, written in place in the output sized once
+void Model::packOBJ(const tinyobj::attrib_t &attrib, const std::vector<tinyobj::shape_t> &shapes) {
+	size_t mainStride = VD->meshStride;
+	size_t count = 0;
+	for (const auto& shape : shapes) {
+		count += shape.mesh.indices.size();
+	}
+	uint32_t v = static_cast<uint32_t>(vertices.size() / mainStride);
+	vertices.resize(vertices.size() + count * mainStride);
+	indices.reserve(indices.size() + count);
+
+	unsigned char *vertex = vertices.data() + v * mainStride;
 	for (const auto& shape : shapes) {
 		for (const auto& index : shape.mesh.indices) {
-			std::vector<unsigned char> vertex(mainStride, 0);
-			glm::vec3 pos = {
-				attrib.vertices[3 * index.vertex_index + 0],
-				attrib.vertices[3 * index.vertex_index + 1],
-				attrib.vertices[3 * index.vertex_index + 2]
-			};
 			if(VD->Position.hasIt) {
-				glm::vec3 *o = (glm::vec3 *)((char*)(&vertex[0]) + VD->Position.offset);
-				*o = pos;
+				memcpy(vertex + VD->Position.offset, &attrib.vertices[3 * index.vertex_index], sizeof(glm::vec3));
 			}
-			
-			glm::vec3 color = {
-				attrib.colors[3 * index.vertex_index + 0],
-				attrib.colors[3 * index.vertex_index + 1],
-				attrib.colors[3 * index.vertex_index + 2]
-			};
-			if(VD->Color.hasIt) {
-				glm::vec3 *o = (glm::vec3 *)((char*)(&vertex[0]) + VD->Color.offset);
-				*o = color;
+			if(VD->Color.hasIt && !attrib.colors.empty()) {
+				memcpy(vertex + VD->Color.offset, &attrib.colors[3 * index.vertex_index], sizeof(glm::vec3));
 			}
-			
-			glm::vec2 texCoord = {
-				attrib.texcoords[2 * index.texcoord_index + 0],
-				1 - attrib.texcoords[2 * index.texcoord_index + 1] 
-			};
-			if(VD->UV.hasIt) {
-				glm::vec2 *o = (glm::vec2 *)((char*)(&vertex[0]) + VD->UV.offset);
-				*o = texCoord;
+			if(VD->UV.hasIt && index.texcoord_index >= 0) {
+				glm::vec2 texCoord = {
+					attrib.texcoords[2 * index.texcoord_index + 0],
+					1 - attrib.texcoords[2 * index.texcoord_index + 1] 
+				};
+				memcpy(vertex + VD->UV.offset, &texCoord, sizeof(glm::vec2));
 			}
-
-			glm::vec3 norm = {
-				attrib.normals[3 * index.normal_index + 0],
-				attrib.normals[3 * index.normal_index + 1],
-				attrib.normals[3 * index.normal_index + 2]
-			};
-			if(VD->Normal.hasIt) {
-				glm::vec3 *o = (glm::vec3 *)((char*)(&vertex[0]) + VD->Normal.offset);
-				*o = norm;
+			if(VD->Normal.hasIt && index.normal_index >= 0) {
+				memcpy(vertex + VD->Normal.offset, &attrib.normals[3 * index.normal_index], sizeof(glm::vec3));
 			}
-			
-			vertices.insert(vertices.end(), vertex.begin(), vertex.end());
-			indices.push_back((vertices.size()/mainStride)-1);
+			indices.push_back(v++);
+			vertex += mainStride;
 		}
 	}
-	std::cout << "[OBJ] Vertices: "<< (vertices.size()/mainStride);
-	std::cout << " Indices: "<< indices.size() << "\n";
-	
+}
+
+// File system of tinygltf on top of readAsset(), for the buffers and images a .gltf references
+static bool gltfAssetExists(const std::string &file, void *) {
+	const char *data;
+	size_t size;
+	return (assetPack().isOpen() && assetPack().find(file, data, size)) || tinygltf::FileExists(file, nullptr);
+}
+
+static bool gltfAssetSize(size_t *size, std::string *err, const std::string &file, void *) {
+	const char *data;
+	if (assetPack().isOpen() && assetPack().find(file, data, *size)) {
+		return true;
+	}
+	return tinygltf::GetFileSizeInBytes(size, err, file, nullptr);
+}
+
+static bool gltfAssetRead(std::vector<unsigned char> *out, std::string *err, const std::string &file, void *) {
+	const char *data;
+	size_t size;
+	if (assetPack().isOpen() && assetPack().find(file, data, size)) {
+		out->assign(data, data + size);
+		return true;
+	}
+	return tinygltf::ReadWholeFile(out, err, file, nullptr);
 }
 
 void Model::loadModelGLTF(std::string file, bool encoded) {
 	tinygltf::Model model;
+	parseGLTF(file, encoded, model);
+	for (const auto& mesh :  model.meshes) {
+		std::cout << "Primitives: " << mesh.primitives.size() << "\n";
+	}
+	packGLTF(model);
+
+	std::cout << (encoded ? "[MGCG]" : "[GLTF]") << " Vertices: " << (vertices.size()/VD->meshStride)
+			  << " Indices: " << indices.size() << "\n";
+/*
+std::cout << model.nodes[0].translation.size() << "\n";
+std::cout << model.nodes[0].rotation.size() << "\n";
+std::cout << model.nodes[0].scale.size() << "\n";
+*/
+				glm::vec3 T;
+				glm::vec3 S;
+				glm::quat Q;
+				if(model.nodes[0].translation.size() > 0) {
+//std::cout << "node " << i << " has T\n";
+					T = glm::vec3(model.nodes[0].translation[0],
+								  model.nodes[0].translation[1],
+								  model.nodes[0].translation[2]);
+				} else {
+					T = glm::vec3(0);
+				}
+				if(model.nodes[0].rotation.size() > 0) {
+//std::cout << "node " << i << " has Q\n";
+					Q = glm::quat(model.nodes[0].rotation[3],
+								  model.nodes[0].rotation[0],
+								  model.nodes[0].rotation[1],
+								  model.nodes[0].rotation[2]);
+				} else {
+					Q = glm::quat(1.0f,0.0f,0.0f,0.0f);
+				}
+				if(model.nodes[0].scale.size() > 0) {
+//std::cout << "node " << i << " has S\n";
+					S = glm::vec3(model.nodes[0].scale[0],
+								  model.nodes[0].scale[1],
+								  model.nodes[0].scale[2]);
+				} else {
+					S = glm::vec3(1);
+				}
+//printVec3("T",T);
+//printQuat("Q",Q);
+//printVec3("S",S);
+				Wm = glm::translate(glm::mat4(1), T) *
+						 glm::mat4(Q) *
+						 glm::scale(glm::mat4(1), S);
+}
+
+void Model::parseGLTF(const std::string &file, bool encoded, tinygltf::Model &model) {
 	tinygltf::TinyGLTF loader;
 	std::string warn, err;
-	
-	int mainStride = VD->Bindings[0].stride;
 
 	std::cout << "Loading : " << file << (encoded ? "[MGCG]" : "[GLTF]") << "\n";	
 	if(encoded) {
-		auto modelString = readFile(file);
+		Asset modelString = readAsset(file);
 		const std::vector<unsigned char> key = plusaes::key_from_string(&"CG2023SkelKey128"); // 16-char = 128-bit
 		const unsigned char iv[16] = {
 			0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
@@ -2555,7 +3793,7 @@ void Model::loadModelGLTF(std::string file, bool encoded) {
 		unsigned long padded_size = 0;
 		std::vector<unsigned char> decrypted(modelString.size());
 
-		plusaes::decrypt_cbc((unsigned char*)modelString.data(), modelString.size(), &key[0], key.size(), &iv, &decrypted[0], decrypted.size(), &padded_size);
+		plusaes::decrypt_cbc((const unsigned char*)modelString.data(), modelString.size(), &key[0], key.size(), &iv, &decrypted[0], decrypted.size(), &padded_size);
 		int size = 0;
 		void *decomp;
 		
@@ -2568,151 +3806,94 @@ void Model::loadModelGLTF(std::string file, bool encoded) {
 		decomp = calloc(size, 1);
 		int n = sinflate(decomp, (int)size, &decrypted[16], decrypted.size()-16);
 		
-		if (!loader.LoadASCIIFromString(&model, &warn, &err, 
-						reinterpret_cast<const char *>(decomp), size, "/")) {
+		bool parsed = loader.LoadASCIIFromString(&model, &warn, &err, 
+						reinterpret_cast<const char *>(decomp), size, "/");
+		free(decomp);
+		if (!parsed) {
 			throw std::runtime_error(warn + err);
 		}
 	} else {
-		if (!loader.LoadASCIIFromFile(&model, &warn, &err, 
-						file.c_str())) {
+		// External buffers and images are resolved through the asset pack as well
+		tinygltf::FsCallbacks fs = {&gltfAssetExists, &tinygltf::ExpandFilePath, &gltfAssetRead,
+									&tinygltf::WriteWholeFile, &gltfAssetSize, nullptr};
+		loader.SetFsCallbacks(fs);
+		Asset source = readAsset(file);
+		std::string baseDir = std::filesystem::path(file).parent_path().string();
+		if (!loader.LoadASCIIFromString(&model, &warn, &err, 
+						source.data(), (unsigned int)source.size(), baseDir)) {
 			throw std::runtime_error(warn + err);
 		}
 	}
+}
+
+// Every primitive is appended to the output, sized once per primitive. Each attribute of the layout is
+// copied with a strided loop (VertexPacker::scatter), and the pos uv normal layout of tightly packed
+// streams is built by VertexPacker::scatterPosUVNormal
+void Model::packGLTF(const tinygltf::Model &model) {
+	struct Stream {
+		const unsigned char *data = nullptr;
+		size_t stride = 0;
+		size_t count = 0;
+	};
+	auto stream = [&model](const tinygltf::Primitive &primitive, const char *name, int components,
+						   bool inLayout, const char *label) {
+		Stream S;
+		auto it = primitive.attributes.find(name);
+		if(it == primitive.attributes.end()) {
+			if(inLayout) {
+				std::cout << "Warning: vertex layout has " << label << ", but file hasn't\n";
+			}
+			return S;
+		}
+		const tinygltf::Accessor &accessor = model.accessors[it->second];
+		const tinygltf::BufferView &view = model.bufferViews[accessor.bufferView];
+		int stride = accessor.ByteStride(view);
+		S.data = &model.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset];
+		S.stride = stride > 0 ? stride : components * sizeof(float);
+		S.count = accessor.count;
+		return S;
+	};
+
+	size_t mainStride = VD->meshStride;
+	const bool posUVNormal = mainStride == VertexPacker::posUVNormalStride && !VD->Tangent.hasIt && !VD->Color.hasIt &&
+							 VD->Position.hasIt && VD->Position.offset == VertexPacker::posOffset &&
+							 VD->UV.hasIt && VD->UV.offset == VertexPacker::uvOffset &&
+							 VD->Normal.hasIt && VD->Normal.offset == VertexPacker::normalOffset;
 
 	for (const auto& mesh :  model.meshes) {
-		std::cout << "Primitives: " << mesh.primitives.size() << "\n";
 		for (const auto& primitive :  mesh.primitives) {
 			if (primitive.indices < 0) {
 				continue;
 			}
 
-			const float *bufferPos = nullptr;
-			const float *bufferNormals = nullptr;
-			const float *bufferTangents = nullptr;
-			const float *bufferTexCoords = nullptr;
-			
-			bool meshHasPos = false;
-			bool meshHasNorm = false;
-			bool meshHasTan = false;
-			bool meshHasUV = false;
-			
-			int cntPos = 0;
-			int cntNorm = 0;
-			int cntTan = 0;
-			int cntUV = 0;
-			int cntTot = 0;
-			
-			auto pIt = primitive.attributes.find("POSITION");
-			if(pIt != primitive.attributes.end()) {
-				const tinygltf::Accessor &posAccessor = model.accessors[pIt->second];
-				const tinygltf::BufferView &posView = model.bufferViews[posAccessor.bufferView];
-				bufferPos = reinterpret_cast<const float *>(&(model.buffers[posView.buffer].data[posAccessor.byteOffset + posView.byteOffset]));
-				meshHasPos = true;
-				cntPos = posAccessor.count;
-				if(cntPos > cntTot) cntTot = cntPos;
-			} else {
-				if(VD->Position.hasIt) {
-					std::cout << "Warning: vertex layout has position, but file hasn't\n";
-				}
-			}
-			
-			auto nIt = primitive.attributes.find("NORMAL");
-			if(nIt != primitive.attributes.end()) {
-				const tinygltf::Accessor &normAccessor = model.accessors[nIt->second];
-				const tinygltf::BufferView &normView = model.bufferViews[normAccessor.bufferView];
-				bufferNormals = reinterpret_cast<const float *>(&(model.buffers[normView.buffer].data[normAccessor.byteOffset + normView.byteOffset]));
-				meshHasNorm = true;
-				cntNorm = normAccessor.count;
-				if(cntNorm > cntTot) cntTot = cntNorm;
-			} else {
-				if(VD->Normal.hasIt) {
-					std::cout << "Warning: vertex layout has normal, but file hasn't\n";
-				}
-			}
+			Stream pos = stream(primitive, "POSITION", 3, VD->Position.hasIt, "position");
+			Stream normal = stream(primitive, "NORMAL", 3, VD->Normal.hasIt, "normal");
+			Stream tangent = stream(primitive, "TANGENT", 4, VD->Tangent.hasIt, "tangent");
+			Stream uv = stream(primitive, "TEXCOORD_0", 2, VD->UV.hasIt, "UV");
+			size_t cntTot = std::max(std::max(pos.count, normal.count), std::max(tangent.count, uv.count));
 
-			auto tIt = primitive.attributes.find("TANGENT");
-			if(tIt != primitive.attributes.end()) {
-				const tinygltf::Accessor &tanAccessor = model.accessors[tIt->second];
-				const tinygltf::BufferView &tanView = model.bufferViews[tanAccessor.bufferView];
-				bufferTangents = reinterpret_cast<const float *>(&(model.buffers[tanView.buffer].data[tanAccessor.byteOffset + tanView.byteOffset]));
-				meshHasTan = true;
-				cntTan = tanAccessor.count;
-				if(cntTan > cntTot) cntTot = cntTan;
-			} else {
-				if(VD->Tangent.hasIt) {
-					std::cout << "Warning: vertex layout has tangent, but file hasn't\n";
-				}
-			}
+			size_t first = vertices.size();
+			vertices.resize(first + cntTot * mainStride);
+			unsigned char *out = vertices.data() + first;
 
-			auto uIt = primitive.attributes.find("TEXCOORD_0");
-			if(uIt != primitive.attributes.end()) {
-				const tinygltf::Accessor &uvAccessor = model.accessors[uIt->second];
-				const tinygltf::BufferView &uvView = model.bufferViews[uvAccessor.bufferView];
-				bufferTexCoords = reinterpret_cast<const float *>(&(model.buffers[uvView.buffer].data[uvAccessor.byteOffset + uvView.byteOffset]));
-				meshHasUV = true;
-				cntUV = uvAccessor.count;
-				if(cntUV > cntTot) cntTot = cntUV;
+			if(posUVNormal && pos.count == cntTot && uv.count == cntTot && normal.count == cntTot &&
+			   pos.stride == 3 * sizeof(float) && uv.stride == 2 * sizeof(float) && normal.stride == 3 * sizeof(float)) {
+				VertexPacker::scatterPosUVNormal(reinterpret_cast<const float *>(pos.data), reinterpret_cast<const float *>(uv.data),
+												 reinterpret_cast<const float *>(normal.data), cntTot, out);
 			} else {
-				if(VD->UV.hasIt) {
-					std::cout << "Warning: vertex layout has UV, but file hasn't\n";
-				}
-			}
-
-//std::cout << "making vertex array. Stride:" << mainStride << "\n";
-			for(int i = 0; i < cntTot; i++) {
-				std::vector<unsigned char> vertex(mainStride, 0);
-//std::cout << vertices.size() << "," << vertex.size() << "," << &vertex << " " << &vertex[0] << " ";
-//std::cout << i << "\n";
-				
-				if((i < cntPos) && meshHasPos && VD->Position.hasIt) {
-					glm::vec3 pos = {
-						bufferPos[3 * i + 0],
-						bufferPos[3 * i + 1],
-						bufferPos[3 * i + 2]
-					};
-//std::cout << "Pos: " <<	VD->Position.offset << "\n";
-					glm::vec3 *o = (glm::vec3 *)((char*)(&vertex[0]) + VD->Position.offset);
-//std::cout << "at: " << o << "\n";
-					*o = pos;
-//std::cout << "Copied: " << o->x << "\n";
+				if(pos.data && VD->Position.hasIt) {
+					VertexPacker::scatter(pos.data, pos.stride, 3, pos.count, out, mainStride, VD->Position.offset);
 				}
-				if((i < cntNorm) && meshHasNorm && VD->Normal.hasIt) {
-					glm::vec3 normal = {
-						bufferNormals[3 * i + 0],
-						bufferNormals[3 * i + 1],
-						bufferNormals[3 * i + 2]
-					};
-//std::cout << "Nor: " <<	VD->Normal.offset << "\n";
-					glm::vec3 *o = (glm::vec3 *)((char*)(&vertex[0]) + VD->Normal.offset);
-					*o = normal;
+				if(normal.data && VD->Normal.hasIt) {
+					VertexPacker::scatter(normal.data, normal.stride, 3, normal.count, out, mainStride, VD->Normal.offset);
 				}
-
-				if((i < cntTan) && meshHasTan && VD->Tangent.hasIt) {
-					glm::vec4 tangent = {
-						bufferTangents[4 * i + 0],
-						bufferTangents[4 * i + 1],
-						bufferTangents[4 * i + 2],
-						bufferTangents[4 * i + 3]
-					};
-//std::cout << "Tan: " <<	VD->Tangent.offset << "\n";
-					glm::vec4 *o = (glm::vec4 *)((char*)(&vertex[0]) + VD->Tangent.offset);
-					*o = tangent;
+				if(tangent.data && VD->Tangent.hasIt) {
+					VertexPacker::scatter(tangent.data, tangent.stride, 4, tangent.count, out, mainStride, VD->Tangent.offset);
 				}
-				
-				if((i < cntUV) && meshHasUV && VD->UV.hasIt) {
-					glm::vec2 texCoord = {
-						bufferTexCoords[2 * i + 0],
-						bufferTexCoords[2 * i + 1] 
-					};
-//std::cout << "UV : " <<	VD->UV.offset << "\n";
-					glm::vec2 *o = (glm::vec2 *)((char*)(&vertex[0]) + VD->UV.offset);
-					*o = texCoord;
+				if(uv.data && VD->UV.hasIt) {
+					VertexPacker::scatter(uv.data, uv.stride, 2, uv.count, out, mainStride, VD->UV.offset);
 				}
-
-//std::cout << vertices.size() << "," << vertex.size() << " Inserting\n";
-				vertices.insert(vertices.end(), vertex.begin(), vertex.end());
-//std::cout << vertices.size() << " Inserted\n";
-			} 
+			}
 
 			const tinygltf::Accessor &accessor = model.accessors[primitive.indices];
 			const tinygltf::BufferView &bufferView = model.bufferViews[accessor.bufferView];
@@ -2722,17 +3903,13 @@ void Model::loadModelGLTF(std::string file, bool encoded) {
 				case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT:
 					{
 						const uint16_t *bufferIndex = reinterpret_cast<const uint16_t *>(&(buffer.data[accessor.byteOffset + bufferView.byteOffset]));
-						for(int i = 0; i < accessor.count; i++) {
-							indices.push_back(bufferIndex[i]);
-						}
+						indices.insert(indices.end(), bufferIndex, bufferIndex + accessor.count);
 					}
 					break;
 				case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT:
 					{
 						const uint32_t *bufferIndex = reinterpret_cast<const uint32_t *>(&(buffer.data[accessor.byteOffset + bufferView.byteOffset]));
-						for(int i = 0; i < accessor.count; i++) {
-							indices.push_back(bufferIndex[i]);
-						}
+						indices.insert(indices.end(), bufferIndex, bufferIndex + accessor.count);
 					}
 					break;
 				default:
@@ -2741,122 +3918,446 @@ void Model::loadModelGLTF(std::string file, bool encoded) {
 			}
 		}
 	}
+}
 
-	std::cout << (encoded ? "[MGCG]" : "[GLTF]") << " Vertices: " << (vertices.size()/mainStride)
-			  << " Indices: " << indices.size() << "\n";
-/*
-std::cout << model.nodes[0].translation.size() << "\n";
-std::cout << model.nodes[0].rotation.size() << "\n";
-std::cout << model.nodes[0].scale.size() << "\n";
-*/
-				glm::vec3 T;
-				glm::vec3 S;
-				glm::quat Q;
-				if(model.nodes[0].translation.size() > 0) {
-//std::cout << "node " << i << " has T\n";
-					T = glm::vec3(model.nodes[0].translation[0],
-								  model.nodes[0].translation[1],
-								  model.nodes[0].translation[2]);
-				} else {
-					T = glm::vec3(0);
+// Microbenchmark: the vertex packing of every model under dir, against the code it replaces (a vector
+// per vertex, appended to the output without a reserve). The files are parsed once, outside the timing
+void Model::benchmarkLoaders(VertexDescriptor *vd, const std::string &dir, int iterations) {
+	struct Source {
+		std::string file;
+		bool obj;
+		tinygltf::Model gltf;
+		tinyobj::attrib_t attrib;
+		std::vector<tinyobj::shape_t> shapes;
+	};
+	std::vector<std::string> files;
+	for (const auto &entry : std::filesystem::recursive_directory_iterator(dir)) {
+		std::string ext = entry.path().extension().string();
+		if (entry.is_regular_file() && (ext == ".mgcg" || ext == ".gltf" || ext == ".obj")) {
+			files.push_back(entry.path().generic_string());
+		}
+	}
+	std::sort(files.begin(), files.end());
+
+	Model M;
+	M.VD = vd;
+	std::vector<Source> sources(files.size());
+	auto parseStart = std::chrono::steady_clock::now();
+	for (size_t f = 0; f < files.size(); f++) {
+		Source &S = sources[f];
+		S.file = files[f];
+		S.obj = std::filesystem::path(S.file).extension() == ".obj";
+		if (S.obj) {
+			M.parseOBJ(S.file, S.attrib, S.shapes);
+		} else {
+			M.parseGLTF(S.file, std::filesystem::path(S.file).extension() == ".mgcg", S.gltf);
+		}
+	}
+	double parseMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - parseStart).count();
+
+	const size_t stride = vd->meshStride;
+	auto reference = [vd, stride](const Source &S, std::vector<unsigned char> &vertices, std::vector<uint32_t> &indices) {
+		auto put = [](std::vector<unsigned char> &vertex, const VertexComponent &C, const float *src, int n) {
+			if (C.hasIt) {
+				memcpy(&vertex[C.offset], src, n * sizeof(float));
+			}
+		};
+		if (S.obj) {
+			for (const auto &shape : S.shapes) {
+				for (const auto &index : shape.mesh.indices) {
+					std::vector<unsigned char> vertex(stride, 0);
+					put(vertex, vd->Position, &S.attrib.vertices[3 * index.vertex_index], 3);
+					if (!S.attrib.colors.empty()) {
+						put(vertex, vd->Color, &S.attrib.colors[3 * index.vertex_index], 3);
+					}
+					if (index.texcoord_index >= 0) {
+						float uv[2] = { S.attrib.texcoords[2 * index.texcoord_index], 1 - S.attrib.texcoords[2 * index.texcoord_index + 1] };
+						put(vertex, vd->UV, uv, 2);
+					}
+					if (index.normal_index >= 0) {
+						put(vertex, vd->Normal, &S.attrib.normals[3 * index.normal_index], 3);
+					}
+					vertices.insert(vertices.end(), vertex.begin(), vertex.end());
+					indices.push_back(static_cast<uint32_t>(vertices.size() / stride - 1));
 				}
-				if(model.nodes[0].rotation.size() > 0) {
-//std::cout << "node " << i << " has Q\n";
-					Q = glm::quat(model.nodes[0].rotation[3],
-								  model.nodes[0].rotation[0],
-								  model.nodes[0].rotation[1],
-								  model.nodes[0].rotation[2]);
-				} else {
-					Q = glm::quat(1.0f,0.0f,0.0f,0.0f);
+			}
+			return;
+		}
+		const tinygltf::Model &model = S.gltf;
+		auto attribute = [&model](const tinygltf::Primitive &primitive, const char *name, int &count) -> const float * {
+			auto it = primitive.attributes.find(name);
+			if (it == primitive.attributes.end()) {
+				return nullptr;
+			}
+			const tinygltf::Accessor &accessor = model.accessors[it->second];
+			const tinygltf::BufferView &view = model.bufferViews[accessor.bufferView];
+			count = static_cast<int>(accessor.count);
+			return reinterpret_cast<const float *>(&model.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]);
+		};
+		for (const auto &mesh : model.meshes) {
+			for (const auto &primitive : mesh.primitives) {
+				if (primitive.indices < 0) {
+					continue;
 				}
-				if(model.nodes[0].scale.size() > 0) {
-//std::cout << "node " << i << " has S\n";
-					S = glm::vec3(model.nodes[0].scale[0],
-								  model.nodes[0].scale[1],
-								  model.nodes[0].scale[2]);
-				} else {
-					S = glm::vec3(1);
+				int cntPos = 0, cntNorm = 0, cntTan = 0, cntUV = 0;
+				const float *pos = attribute(primitive, "POSITION", cntPos);
+				const float *norm = attribute(primitive, "NORMAL", cntNorm);
+				const float *tan = attribute(primitive, "TANGENT", cntTan);
+				const float *uv = attribute(primitive, "TEXCOORD_0", cntUV);
+				int cntTot = std::max(std::max(cntPos, cntNorm), std::max(cntTan, cntUV));
+				for (int i = 0; i < cntTot; i++) {
+					std::vector<unsigned char> vertex(stride, 0);
+					if (i < cntPos) put(vertex, vd->Position, pos + 3 * i, 3);
+					if (i < cntNorm) put(vertex, vd->Normal, norm + 3 * i, 3);
+					if (i < cntTan) put(vertex, vd->Tangent, tan + 4 * i, 4);
+					if (i < cntUV) put(vertex, vd->UV, uv + 2 * i, 2);
+					vertices.insert(vertices.end(), vertex.begin(), vertex.end());
 				}
-//printVec3("T",T);
-//printQuat("Q",Q);
-//printVec3("S",S);
-				Wm = glm::translate(glm::mat4(1), T) *
-						 glm::mat4(Q) *
-						 glm::scale(glm::mat4(1), S);
+				const tinygltf::Accessor &accessor = model.accessors[primitive.indices];
+				const tinygltf::BufferView &view = model.bufferViews[accessor.bufferView];
+				const unsigned char *data = &model.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset];
+				for (size_t i = 0; i < accessor.count; i++) {
+					indices.push_back(accessor.componentType == TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT ?
+									  reinterpret_cast<const uint16_t *>(data)[i] : reinterpret_cast<const uint32_t *>(data)[i]);
+				}
+			}
+		}
+	};
+
+	std::vector<std::vector<unsigned char>> refVertices(sources.size()), fastVertices(sources.size());
+	std::vector<std::vector<uint32_t>> refIndices(sources.size()), fastIndices(sources.size());
+	auto time = [iterations](auto &&run) {
+		auto start = std::chrono::steady_clock::now();
+		for (int k = 0; k < iterations; k++) {
+			run();
+		}
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+	};
+	double referenceMs = time([&]() {
+		for (size_t f = 0; f < sources.size(); f++) {
+			refVertices[f] = std::vector<unsigned char>();
+			refIndices[f] = std::vector<uint32_t>();
+			reference(sources[f], refVertices[f], refIndices[f]);
+		}
+	});
+	double packedMs = time([&]() {
+		for (size_t f = 0; f < sources.size(); f++) {
+			M.vertices = std::vector<unsigned char>();
+			M.indices = std::vector<uint32_t>();
+			if (sources[f].obj) {
+				M.packOBJ(sources[f].attrib, sources[f].shapes);
+			} else {
+				M.packGLTF(sources[f].gltf);
+			}
+			fastVertices[f] = std::move(M.vertices);
+			fastIndices[f] = std::move(M.indices);
+		}
+	});
+
+	size_t vertexCount = 0, mismatches = 0;
+	for (size_t f = 0; f < sources.size(); f++) {
+		vertexCount += fastVertices[f].size() / stride;
+		if (refVertices[f] != fastVertices[f] || refIndices[f] != fastIndices[f]) {
+			std::cout << "  mismatch: " << sources[f].file << "\n";
+			mismatches++;
+		}
+	}
+	std::cout << "Model loaders, " << sources.size() << " files in " << dir << ", " << vertexCount << " vertices, "
+			  << iterations << " iterations (" << VertexPacker::path() << ")\n";
+	std::cout << "  parse      : " << parseMs << " ms, once\n";
+	std::cout << "  per vertex : " << referenceMs << " ms/pass\n";
+	std::cout << "  packed     : " << packedMs << " ms/pass, " << referenceMs / packedMs << "x, "
+			  << (mismatches ? "output differs" : "same output") << "\n";
 }
 
 void Model::createVertexBuffer() {
 //	VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
 	VkDeviceSize bufferSize = vertices.size();
 
-	BP->createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 
-						VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-						VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-						vertexBuffer, vertexBufferMemory);
-
-	void* data;
-	vkMapMemory(BP->device, vertexBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, vertices.data(), (size_t) bufferSize);
-	vkUnmapMemory(BP->device, vertexBufferMemory);			
+	BP->createDeviceLocalBuffer(vertices.data(), bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+								vertexBuffer, vertexBufferMemory);
 }
 
 void Model::createIndexBuffer() {
+	// Half the index fetch when the mesh has few enough vertices
+	if(MeshOptimizer::fitsUint16(indices)) {
+		std::vector<uint16_t> indices16(indices.begin(), indices.end());
+		indexType = VK_INDEX_TYPE_UINT16;
+		BP->createDeviceLocalBuffer(indices16.data(), sizeof(indices16[0]) * indices16.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+									indexBuffer, indexBufferMemory);
+		return;
+	}
 	VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
 
-	BP->createBuffer(bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-							 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-							 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-							 indexBuffer, indexBufferMemory);
+	indexType = VK_INDEX_TYPE_UINT32;
+	BP->createDeviceLocalBuffer(indices.data(), bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+								indexBuffer, indexBufferMemory);
+}
+
+// Welds the duplicate vertices and reorders triangles and vertices for the vertex cache (MeshOptimizer)
+void Model::optimizeMesh() {
+	size_t mainStride = VD->meshStride;
+	if(indices.size() < 3 || indices.size() % 3 != 0) {
+		return;
+	}
+	size_t before = vertices.size() / mainStride;
+	float acmrBefore = MeshOptimizer::acmr(indices, before);
+
+	MeshOptimizer::weld(vertices, mainStride, indices);
+	MeshOptimizer::optimizeTriangles(indices, vertices.size() / mainStride);
+	MeshOptimizer::optimizeFetch(vertices, mainStride, indices);
 
-	void* data;
-	vkMapMemory(BP->device, indexBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, indices.data(), (size_t) bufferSize);
-	vkUnmapMemory(BP->device, indexBufferMemory);
+	size_t after = vertices.size() / mainStride;
+	std::cout << "Optimized: " << before << " -> " << after << " vertices, ACMR " << acmrBefore
+			  << " -> " << MeshOptimizer::acmr(indices, after) << "\n";
+}
+
+// Sphere centered in the middle of the bounding box of the vertices
+void Model::computeBounds() {
+	int mainStride = VD->meshStride;
+	size_t count = vertices.size() / mainStride;
+	if(!VD->Position.hasIt || count == 0) {
+		bounds = glm::vec4(0.0f);
+		return;
+	}
+	glm::vec3 lo(std::numeric_limits<float>::max()), hi(-std::numeric_limits<float>::max());
+	for(size_t i = 0; i < count; i++) {
+		glm::vec3 p = *(glm::vec3 *)(&vertices[i * mainStride] + VD->Position.offset);
+		lo = glm::min(lo, p);
+		hi = glm::max(hi, p);
+	}
+	glm::vec3 center = (lo + hi) * 0.5f;
+	float radius2 = 0.0f;
+	for(size_t i = 0; i < count; i++) {
+		glm::vec3 d = *(glm::vec3 *)(&vertices[i * mainStride] + VD->Position.offset) - center;
+		radius2 = std::max(radius2, glm::dot(d, d));
+	}
+	bounds = glm::vec4(center, std::sqrt(radius2));
 }
 
-void Model::initMesh(BaseProject *bp, VertexDescriptor *vd) {
+void Model::initMesh(BaseProject *bp, VertexDescriptor *vd, GeometryPool *gp) {
 	BP = bp;
 	VD = vd;
-	int mainStride = VD->Bindings[0].stride;
+	pool = gp;
+	int mainStride = VD->meshStride;
 	std::cout << "[Manual] Vertices: " << (vertices.size()/mainStride)
 			  << " Indices: " << indices.size() << "\n";
-	createVertexBuffer();
-	createIndexBuffer();
+	indexCount = static_cast<uint32_t>(indices.size());
+	computeBounds();
+	if(pool) {
+		pool->add(*this);
+	} else {
+		createVertexBuffer();
+		createIndexBuffer();
+	}
 	Wm = glm::mat4(1);
 }
 
-void Model::init(BaseProject *bp, VertexDescriptor *vd, std::string file, ModelType MT) {
+void Model::init(BaseProject *bp, VertexDescriptor *vd, std::string file, ModelType MT, GeometryPool *gp) {
+	load(bp, vd, file, MT, gp);
+	upload();
+}
+
+void Model::load(BaseProject *bp, VertexDescriptor *vd, std::string file, ModelType MT, GeometryPool *gp) {
 	BP = bp;
 	VD = vd;
+	pool = gp;
 	Wm = glm::mat4(1);
 
-	if(MT == OBJ) {
-		loadModelOBJ(file);
-	} else if(MT == GLTF) {
-		loadModelGLTF(file, false);
-	} else if(MT == MGCG) {
-		loadModelGLTF(file, true);
+	// The mesh cache skips decryption, inflate, parse and vertex packing when the source is unchanged
+	std::string cacheFile;
+	uint64_t sourceHash = 0, layout = 0;
+	if(!BP->meshCacheDir.empty()) {
+		Asset source = readAsset(file);
+		sourceHash = MeshCache::hash(source.data(), source.size());
+		layout = MeshCache::layoutHash(VD);
+		cacheFile = MeshCache::path(BP->meshCacheDir, file, layout);
+	}
+
+	if(!cacheFile.empty() && MeshCache::read(cacheFile, sourceHash, layout, vertices, indices, Wm)) {
+		std::cout << "Loading : " << file << "[cache]\n";
+	} else {
+		if(MT == OBJ) {
+			loadModelOBJ(file);
+		} else if(MT == GLTF) {
+			loadModelGLTF(file, false);
+		} else if(MT == MGCG) {
+			loadModelGLTF(file, true);
+		}
+		optimizeMesh();
+		if(!cacheFile.empty()) {
+			MeshCache::write(cacheFile, sourceHash, layout, vertices, indices, Wm);
+		}
+	}
+		
+	indexCount = static_cast<uint32_t>(indices.size());
+	computeBounds();
+}
+
+void Model::upload() {
+	if(pool) {
+		pool->add(*this);
+	} else {
+		createVertexBuffer();
+		createIndexBuffer();
 	}
-	
-	createVertexBuffer();
-	createIndexBuffer();
 }
 
 void Model::cleanup() {
-   	vkDestroyBuffer(BP->device, indexBuffer, nullptr);
-   	vkFreeMemory(BP->device, indexBufferMemory, nullptr);
-	vkDestroyBuffer(BP->device, vertexBuffer, nullptr);
-   	vkFreeMemory(BP->device, vertexBufferMemory, nullptr);
+	// The buffers of a pooled model belong to the pool
+	if(pool) {
+		return;
+	}
+   	BP->destroyBuffer(indexBuffer, indexBufferMemory);
+	BP->destroyBuffer(vertexBuffer, vertexBufferMemory);
 }
 
 void Model::bind(VkCommandBuffer commandBuffer) {
+	if(pool) {
+		pool->bind(commandBuffer);
+		return;
+	}
 	VkBuffer vertexBuffers[] = {vertexBuffer};
 	// property .vertexBuffer of models, contains the VkBuffer handle to its vertex buffer
 	VkDeviceSize offsets[] = {0};
-	vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+	vkCmdBindVertexBuffers(commandBuffer, VD->meshBinding, 1, vertexBuffers, offsets);
 	// property .indexBuffer of models, contains the VkBuffer handle to its index buffer
 	vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0,
-							VK_INDEX_TYPE_UINT32);
+							indexType);
+}
+
+// Binds the mesh and, at its own binding, the region of the instance buffer used by the frame
+void Model::bind(VkCommandBuffer commandBuffer, InstanceBuffer &instances, int currentImage) {
+	bind(commandBuffer);
+	instances.bind(commandBuffer, currentImage);
+}
+
+void GeometryPool::init(BaseProject *bp, VertexDescriptor *vd) {
+	BP = bp;
+	VD = vd;
+	vertices.clear();
+	indices.clear();
+	models = 0;
+	uploaded = false;
+	vertexBuffer = VK_NULL_HANDLE;
+	indexBuffer = VK_NULL_HANDLE;
+}
+
+// Appends the mesh of the model; the indices stay relative to the model, vertexOffset moves them
+void GeometryPool::add(Model &M) {
+	if(uploaded) {
+		throw std::runtime_error("models cannot be added to a geometry pool after its upload!");
+	}
+	if(M.VD != VD) {
+		throw std::runtime_error("the models of a geometry pool must share its vertex descriptor!");
+	}
+	M.firstIndex = static_cast<uint32_t>(indices.size());
+	M.vertexOffset = static_cast<int32_t>(vertices.size() / VD->meshStride);
+	vertices.insert(vertices.end(), M.vertices.begin(), M.vertices.end());
+	indices.insert(indices.end(), M.indices.begin(), M.indices.end());
+	models++;
+}
+
+void GeometryPool::upload() {
+	uploaded = true;
+	if(indices.empty()) {
+		return;
+	}
+	BP->createDeviceLocalBuffer(vertices.data(), vertices.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+								vertexBuffer, vertexBufferMemory);
+	// The indices are relative to each model: 16 bit as soon as every model has fewer than 65535 vertices
+	if(MeshOptimizer::fitsUint16(indices)) {
+		std::vector<uint16_t> indices16(indices.begin(), indices.end());
+		indexType = VK_INDEX_TYPE_UINT16;
+		BP->createDeviceLocalBuffer(indices16.data(), sizeof(indices16[0]) * indices16.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+									indexBuffer, indexBufferMemory);
+	} else {
+		indexType = VK_INDEX_TYPE_UINT32;
+		BP->createDeviceLocalBuffer(indices.data(), sizeof(indices[0]) * indices.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+									indexBuffer, indexBufferMemory);
+	}
+	std::cout << "Geometry pool: " << models << " models, " << (vertices.size() / VD->meshStride)
+			  << " vertices, " << indices.size() << (indexType == VK_INDEX_TYPE_UINT16 ? " 16" : " 32") << " bit indices\n";
+	// The staging buffers already hold a copy
+	vertices.clear();
+	vertices.shrink_to_fit();
+	indices.clear();
+	indices.shrink_to_fit();
+}
+
+void GeometryPool::cleanup() {
+	if(vertexBuffer != VK_NULL_HANDLE) {
+		BP->destroyBuffer(indexBuffer, indexBufferMemory);
+		BP->destroyBuffer(vertexBuffer, vertexBufferMemory);
+		vertexBuffer = VK_NULL_HANDLE;
+		indexBuffer = VK_NULL_HANDLE;
+	}
+}
+
+void GeometryPool::bind(VkCommandBuffer commandBuffer) {
+	VkDeviceSize offsets[] = {0};
+	vkCmdBindVertexBuffers(commandBuffer, VD->meshBinding, 1, &vertexBuffer, offsets);
+	vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, indexType);
+}
+
+void DrawList::init(BaseProject *bp, uint32_t count, bool dynamic) {
+	BP = bp;
+	capacity = std::max<uint32_t>(count, 1);
+	perFrame = dynamic;
+	regions = perFrame ? static_cast<uint32_t>(BP->swapChainImages.size()) : 1;
+	commands.clear();
+	commands.reserve(capacity);
+	BP->createBuffer(sizeof(VkDrawIndexedIndirectCommand) * capacity * regions, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+					 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+					 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					 buffer, bufferMemory);
+}
+
+void DrawList::cleanup() {
+	BP->destroyBuffer(buffer, bufferMemory);
+}
+
+void DrawList::clear() {
+	commands.clear();
+}
+
+void DrawList::add(const Model &M, uint32_t instanceCount, uint32_t firstInstance) {
+	if(instanceCount == 0 || M.indexCount == 0) {
+		return;
+	}
+	if(commands.size() >= capacity) {
+		throw std::runtime_error("too many draws for the draw list!");
+	}
+	VkDrawIndexedIndirectCommand C{};
+	C.indexCount = M.indexCount;
+	C.instanceCount = instanceCount;
+	C.firstIndex = M.firstIndex;
+	C.vertexOffset = M.vertexOffset;
+	C.firstInstance = firstInstance;
+	commands.push_back(C);
+}
+
+void DrawList::upload(int currentImage) {
+	VkDeviceSize offset = perFrame ? sizeof(VkDrawIndexedIndirectCommand) * capacity * currentImage : 0;
+	memcpy(static_cast<char *>(bufferMemory.mapped) + offset, commands.data(),
+		   sizeof(VkDrawIndexedIndirectCommand) * commands.size());
+}
+
+// The geometry pool of the models, and the instance data, must be already bound.
+// A per-frame list must be recorded after its upload for the same image
+void DrawList::draw(VkCommandBuffer commandBuffer, int currentImage) {
+	if(commands.empty()) {
+		return;
+	}
+	if(BP->multiDrawIndirect) {
+		VkDeviceSize offset = perFrame ? sizeof(VkDrawIndexedIndirectCommand) * capacity * currentImage : 0;
+		vkCmdDrawIndexedIndirect(commandBuffer, buffer, offset, static_cast<uint32_t>(commands.size()),
+								 sizeof(VkDrawIndexedIndirectCommand));
+	} else {
+		for(const VkDrawIndexedIndirectCommand &C : commands) {
+			vkCmdDrawIndexed(commandBuffer, C.indexCount, C.instanceCount, C.firstIndex, C.vertexOffset, C.firstInstance);
+		}
+	}
 }
 
 
@@ -2864,14 +4365,14 @@ void Model::bind(VkCommandBuffer commandBuffer) {
 
 
 
-void Texture::createTextureImage(std::vector<std::string>files, VkFormat Fmt = VK_FORMAT_R8G8B8A8_SRGB) {
-	int texWidth, texHeight, texChannels;
+void Texture::decodeImages(std::vector<std::string>files) {
+	int texChannels;
 	int curWidth = -1, curHeight = -1, curChannels = -1;
-	stbi_uc* pixels[maxImgs];
 	
 	for(int i = 0; i < imgs; i++) {
-	 	pixels[i] = stbi_load(files[i].c_str(), &texWidth, &texHeight,
-						&texChannels, STBI_rgb_alpha);
+		Asset image = readAsset(files[i]);
+	 	pixels[i] = stbi_load_from_memory(reinterpret_cast<const stbi_uc *>(image.data()), (int)image.size(),
+						&texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
 		if (!pixels[i]) {
 			std::cout << "Not found: " << files[i] << "\n";
 			throw std::runtime_error("failed to load texture image!");
@@ -2891,26 +4392,27 @@ void Texture::createTextureImage(std::vector<std::string>files, VkFormat Fmt = V
 			}
 		}
 	}
-	
+}
+
+void Texture::createTextureImage(VkFormat Fmt = VK_FORMAT_R8G8B8A8_SRGB) {
 	VkDeviceSize imageSize = texWidth * texHeight * 4;
 	VkDeviceSize totalImageSize = texWidth * texHeight * 4 * imgs;
 	mipLevels = static_cast<uint32_t>(std::floor(
 					std::log2(std::max(texWidth, texHeight)))) + 1;
 	
 	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
+	GpuAllocation stagingBufferMemory;
 	 
 	BP->createBuffer(totalImageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 	  						VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
 	  						VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-	  						stagingBuffer, stagingBufferMemory);
-	void* data;
-	vkMapMemory(BP->device, stagingBufferMemory, 0, totalImageSize, 0, &data);
+	  						stagingBuffer, stagingBufferMemory,
+	  						GPU_MEMORY_TRANSIENT);
+	void* data = stagingBufferMemory.mapped;
 	for(int i = 0; i < imgs; i++) {
 		memcpy(static_cast<char *>(data) + imageSize * i, pixels[i], static_cast<size_t>(imageSize));
 		stbi_image_free(pixels[i]);
 	}
-	vkUnmapMemory(BP->device, stagingBufferMemory);
 	
 	
 	BP->createImage(texWidth, texHeight, mipLevels, imgs, VK_SAMPLE_COUNT_1_BIT, Fmt,
@@ -2928,8 +4430,7 @@ void Texture::createTextureImage(std::vector<std::string>files, VkFormat Fmt = V
 	BP->generateMipmaps(textureImage, Fmt,
 					texWidth, texHeight, mipLevels, imgs);
 
-	vkDestroyBuffer(BP->device, stagingBuffer, nullptr);
-	vkFreeMemory(BP->device, stagingBufferMemory, nullptr);
+	BP->destroyBuffer(stagingBuffer, stagingBufferMemory);
 }
 
 void Texture::createTextureImageView(VkFormat Fmt = VK_FORMAT_R8G8B8A8_SRGB) {
@@ -2980,11 +4481,22 @@ void Texture::createTextureSampler(
 
 
 void Texture::init(BaseProject *bp, std::string file, VkFormat Fmt = VK_FORMAT_R8G8B8A8_SRGB, bool initSampler = true) {
+	load(bp, file, Fmt, initSampler);
+	upload();
+}
+
+void Texture::load(BaseProject *bp, std::string file, VkFormat Fmt = VK_FORMAT_R8G8B8A8_SRGB, bool initSampler = true) {
 	BP = bp;
 	imgs = 1;
-	createTextureImage({file}, Fmt);
-	createTextureImageView(Fmt);
-	if(initSampler) {
+	format = Fmt;
+	withSampler = initSampler;
+	decodeImages({file});
+}
+
+void Texture::upload() {
+	createTextureImage(format);
+	createTextureImageView(format);
+	if(withSampler) {
 		createTextureSampler();
 	}
 }
@@ -2997,17 +4509,17 @@ void Texture::initCubic(BaseProject *bp, std::vector<std::string>files, VkFormat
 	}
 	BP = bp;
 	imgs = 6;
-	createTextureImage(files, Fmt);
-	createTextureImageView(Fmt);
-	createTextureSampler();
+	format = Fmt;
+	withSampler = true;
+	decodeImages(files);
+	upload();
 }
 
 
 void Texture::cleanup() {
    	vkDestroySampler(BP->device, textureSampler, nullptr);
    	vkDestroyImageView(BP->device, textureImageView, nullptr);
-	vkDestroyImage(BP->device, textureImage, nullptr);
-	vkFreeMemory(BP->device, textureImageMemory, nullptr);
+	BP->destroyImage(textureImage, textureImageMemory);
 }
 
 
@@ -3020,8 +4532,8 @@ void Pipeline::init(BaseProject *bp, VertexDescriptor *vd,
 	BP = bp;
 	VD = vd;
 	
-	auto vertShaderCode = readFile(VertShader);
-	auto fragShaderCode = readFile(FragShader);
+	Asset vertShaderCode = readAsset(VertShader);
+	Asset fragShaderCode = readAsset(FragShader);
 	std::cout << "Vertex shader <" << VertShader << "> len: " << 
 				vertShaderCode.size() << "\n";
 	std::cout << "Fragment shader <" << FragShader << "> len: " <<
@@ -3237,7 +4749,7 @@ void Pipeline::bind(VkCommandBuffer commandBuffer) {
 
 }
 
-VkShaderModule Pipeline::createShaderModule(const std::vector<char>& code) {
+VkShaderModule Pipeline::createShaderModule(const Asset& code) {
 	VkShaderModuleCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
 	createInfo.codeSize = code.size();
@@ -3264,12 +4776,17 @@ void DescriptorSetLayout::init(BaseProject *bp, std::vector<DescriptorSetLayoutB
 	BP = bp;
 	Bindings = B;
 	imgInfoSize = 0;
+	dynamicCount = 0;
 	
 	std::vector<VkDescriptorSetLayoutBinding> binds;
 	binds.resize(B.size());
 	for(int i = 0; i < B.size(); i++) {
 		binds[i].binding = B[i].binding;
 		binds[i].descriptorType = B[i].type;
+		if(B[i].type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
+			binds[i].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+			dynamicCount += B[i].count;
+		}
 		binds[i].descriptorCount = B[i].count;
 		binds[i].stageFlags = B[i].flags;
 		binds[i].pImmutableSamplers = nullptr;
@@ -3296,7 +4813,8 @@ void DescriptorSetLayout::cleanup() {
 }
 
 void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
-						 std::vector<Texture *>Txs) {
+						 std::vector<Texture *>Txs, std::vector<int> elements,
+						 std::vector<SharedBuffer *> shared) {
 	BP = bp;
 	Layout = DSL;
 	
@@ -3304,116 +4822,221 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 	int imgInfoSize = DSL->imgInfoSize;
 //std::cout << "imgInfoSize: " << imgInfoSize << "(" << size << ")\n";
 	
-	uniformBuffers.resize(size);
-	uniformBuffersMemory.resize(size);
+	uniformSlots.resize(size, 0);
+	storageBuffers.resize(size, VK_NULL_HANDLE);
+	storageBuffersMemory.resize(size);
+	bufferSizes.resize(size, 0);
 	toFree.resize(size);
+	// every dynamic binding points at the same frame region, so they share the same offset
+	dynamicOffsets.resize(DSL->dynamicCount, 0);
 
 //std::cout << "Descriptor set init: " << E.size() << "\n";
 	for (int j = 0; j < size; j++) {
-		uniformBuffers[j].resize(BP->swapChainImages.size());
-		uniformBuffersMemory[j].resize(BP->swapChainImages.size());
 //std::cout << j << " " << E[j].type << "\n";
-		if(DSL->Bindings[j].type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
+		toFree[j] = false;
+		if(j < shared.size() && shared[j] != nullptr) {
+			if(shared[j]->type != DSL->Bindings[j].type) {
+				throw std::runtime_error("shared buffer type does not match its binding!");
+			}
+			bufferSizes[j] = shared[j]->size;
+			uniformSlots[j] = shared[j]->uniformSlot;
+			storageBuffers[j] = shared[j]->storageBuffer;
+			storageBuffersMemory[j] = shared[j]->storageBufferMemory;
+		} else if(DSL->Bindings[j].type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
 //std::cout << "Uniform size: " << E[j].size << "\n";
-			for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
-				VkDeviceSize bufferSize = DSL->Bindings[j].linkSize;
-				BP->createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-									 	 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-									 	 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-									 	 uniformBuffers[j][i], uniformBuffersMemory[j][i]);
+			bufferSizes[j] = DSL->Bindings[j].linkSize;
+			uniformSlots[j] = BP->reserveUniformSlot(bufferSizes[j]);
+		} else if(DSL->Bindings[j].type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) {
+			VkDeviceSize bufferSize = DSL->Bindings[j].linkSize;
+			if (j < elements.size() && elements[j] > 1) {
+				bufferSize *= elements[j];
 			}
+			bufferSizes[j] = bufferSize;
+			BP->createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+								 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+								 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+								 storageBuffers[j], storageBuffersMemory[j]);
 			toFree[j] = true;
-		} else {
-			toFree[j] = false;
 		}
 	}
 	
-	std::vector<VkDescriptorSetLayout> layouts(BP->swapChainImages.size(),
-											   DSL->descriptorSetLayout);
 	VkDescriptorSetAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = BP->descriptorPool;
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(BP->swapChainImages.size());
-	allocInfo.pSetLayouts = layouts.data();
-	
-	descriptorSets.resize(BP->swapChainImages.size());
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &DSL->descriptorSetLayout;
 	
 	VkResult result = vkAllocateDescriptorSets(BP->device, &allocInfo,
-										descriptorSets.data());
+										&descriptorSet);
 	if (result != VK_SUCCESS) {
 		PrintVkError(result);
 		throw std::runtime_error("failed to allocate descriptor sets!");
 	}
 	
-	for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
-		std::vector<VkWriteDescriptorSet> descriptorWrites(size);
-		std::vector<VkDescriptorBufferInfo> bufferInfo(size);
-		std::vector<VkDescriptorImageInfo> imageInfo(imgInfoSize);
-		for (int j = 0; j < size; j++) {
-			if(DSL->Bindings[j].type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
-				bufferInfo[j].buffer = uniformBuffers[j][i];
-				bufferInfo[j].offset = 0;
-				bufferInfo[j].range = DSL->Bindings[j].linkSize;
-				
-				descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-				descriptorWrites[j].dstSet = descriptorSets[i];
-				descriptorWrites[j].dstBinding = DSL->Bindings[j].binding;
-				descriptorWrites[j].dstArrayElement = 0;
-				descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-				descriptorWrites[j].descriptorCount = DSL->Bindings[j].count;
-				descriptorWrites[j].pBufferInfo = &bufferInfo[j];
-			} else if(DSL->Bindings[j].type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER) {
-				for(int k = 0; k < DSL->Bindings[j].count; k++) {
-					int h = DSL->Bindings[j].linkSize + k;
-					Texture *Tx = Txs[h];
-					imageInfo[h].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-					imageInfo[h].imageView = Tx->textureImageView;
-					imageInfo[h].sampler = Tx->textureSampler;
-				}
-		
-				descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-				descriptorWrites[j].dstSet = descriptorSets[i];
-				descriptorWrites[j].dstBinding = DSL->Bindings[j].binding;
-				descriptorWrites[j].dstArrayElement = 0;
-				descriptorWrites[j].descriptorType =
-											VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-				descriptorWrites[j].descriptorCount = DSL->Bindings[j].count;
-				descriptorWrites[j].pImageInfo = &imageInfo[DSL->Bindings[j].linkSize];
+	std::vector<VkWriteDescriptorSet> descriptorWrites(size);
+	std::vector<VkDescriptorBufferInfo> bufferInfo(size);
+	std::vector<VkDescriptorImageInfo> imageInfo(imgInfoSize);
+	for (int j = 0; j < size; j++) {
+		if(DSL->Bindings[j].type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
+			bufferInfo[j].buffer = BP->uniformRingBuffer;
+			bufferInfo[j].offset = uniformSlots[j];
+			bufferInfo[j].range = bufferSizes[j];
+			
+			descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[j].dstSet = descriptorSet;
+			descriptorWrites[j].dstBinding = DSL->Bindings[j].binding;
+			descriptorWrites[j].dstArrayElement = 0;
+			descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+			descriptorWrites[j].descriptorCount = DSL->Bindings[j].count;
+			descriptorWrites[j].pBufferInfo = &bufferInfo[j];
+		} else if(DSL->Bindings[j].type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) {
+			bufferInfo[j].buffer = storageBuffers[j];
+			bufferInfo[j].offset = 0;
+			bufferInfo[j].range = bufferSizes[j];
+			
+			descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[j].dstSet = descriptorSet;
+			descriptorWrites[j].dstBinding = DSL->Bindings[j].binding;
+			descriptorWrites[j].dstArrayElement = 0;
+			descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[j].descriptorCount = DSL->Bindings[j].count;
+			descriptorWrites[j].pBufferInfo = &bufferInfo[j];
+		} else if(DSL->Bindings[j].type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER) {
+			for(int k = 0; k < DSL->Bindings[j].count; k++) {
+				int h = DSL->Bindings[j].linkSize + k;
+				Texture *Tx = Txs[h];
+				imageInfo[h].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+				imageInfo[h].imageView = Tx->textureImageView;
+				imageInfo[h].sampler = Tx->textureSampler;
 			}
-		}		
-		vkUpdateDescriptorSets(BP->device,
-						static_cast<uint32_t>(descriptorWrites.size()),
-						descriptorWrites.data(), 0, nullptr);
-	}
+	
+			descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[j].dstSet = descriptorSet;
+			descriptorWrites[j].dstBinding = DSL->Bindings[j].binding;
+			descriptorWrites[j].dstArrayElement = 0;
+			descriptorWrites[j].descriptorType =
+										VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			descriptorWrites[j].descriptorCount = DSL->Bindings[j].count;
+			descriptorWrites[j].pImageInfo = &imageInfo[DSL->Bindings[j].linkSize];
+		}
+	}		
+	vkUpdateDescriptorSets(BP->device,
+					static_cast<uint32_t>(descriptorWrites.size()),
+					descriptorWrites.data(), 0, nullptr);
 }
 
 void DescriptorSet::cleanup() {
-	for(int j = 0; j < uniformBuffers.size(); j++) {
+	for(int j = 0; j < storageBuffers.size(); j++) {
 		if(toFree[j]) {
-			for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
-				vkDestroyBuffer(BP->device, uniformBuffers[j][i], nullptr);
-				vkFreeMemory(BP->device, uniformBuffersMemory[j][i], nullptr);
-			}
+			BP->destroyBuffer(storageBuffers[j], storageBuffersMemory[j]);
 		}
 	}
 }
 
 void DescriptorSet::bind(VkCommandBuffer commandBuffer, Pipeline &P, int setId,
 						 int currentImage) {
-//std::cout << "DS[ci]: " << &descriptorSets[currentImage] << "\n";
+//std::cout << "DS[ci]: " << &descriptorSet << "\n";
+	std::fill(dynamicOffsets.begin(), dynamicOffsets.end(), BP->uniformFrameOffset(currentImage));
 	vkCmdBindDescriptorSets(commandBuffer,
 					VK_PIPELINE_BIND_POINT_GRAPHICS,
-					P.pipelineLayout, setId, 1, &descriptorSets[currentImage],
-					0, nullptr);
+					P.pipelineLayout, setId, 1, &descriptorSet,
+					static_cast<uint32_t>(dynamicOffsets.size()), dynamicOffsets.data());
 }
 
+// Uniform bindings are written in the frame region of currentImage, storage bindings are shared by all the frames
 void DescriptorSet::map(int currentImage, void *src, int slot) {
-	void* data;
+	VkDeviceSize size = bufferSizes[slot];
+
+	memcpy(mapped(currentImage, slot), src, size);
+}
+
+// Returns the GPU-visible memory of a binding, so the caller can build the block in place
+void *DescriptorSet::mapped(int currentImage, int slot) {
+	if(Layout->Bindings[slot].type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) {
+		return storageBuffersMemory[slot].mapped;
+	}
+	return BP->uniformFrameData(currentImage, uniformSlots[slot]);
+}
 
-	int size = Layout->Bindings[slot].linkSize;
+void SharedBuffer::init(BaseProject *bp, VkDescriptorType t, VkDeviceSize s) {
+	BP = bp;
+	type = t;
+	size = s;
+	uniformSlot = 0;
+	storageBuffer = VK_NULL_HANDLE;
+
+	if(type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
+		uniformSlot = BP->reserveUniformSlot(size);
+	} else if(type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) {
+		BP->createBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+							 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+							 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+							 storageBuffer, storageBufferMemory);
+	} else {
+		throw std::runtime_error("shared buffers must be uniform or storage buffers!");
+	}
+}
+
+void SharedBuffer::cleanup() {
+	if(type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) {
+		BP->destroyBuffer(storageBuffer, storageBufferMemory);
+	}
+}
+
+// Written once, seen by every descriptor set that points at it
+void SharedBuffer::map(int currentImage, void *src) {
+	memcpy(mapped(currentImage), src, size);
+}
+
+void *SharedBuffer::mapped(int currentImage) {
+	if(type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) {
+		return storageBufferMemory.mapped;
+	}
+	return BP->uniformFrameData(currentImage, uniformSlot);
+}
+
+void InstanceBuffer::init(BaseProject *bp, VertexDescriptor *VD, uint32_t b, uint32_t count, bool dynamic) {
+	BP = bp;
+	binding = b;
+	capacity = std::max<uint32_t>(count, 1);
+	perFrame = dynamic;
+	stride = 0;
+	for(int i = 0; i < VD->Bindings.size(); i++) {
+		if(VD->Bindings[i].binding == binding && VD->Bindings[i].inputRate == VK_VERTEX_INPUT_RATE_INSTANCE) {
+			stride = VD->Bindings[i].stride;
+		}
+	}
+	if(stride == 0) {
+		throw std::runtime_error("instance buffers need a per-instance binding of the vertex descriptor!");
+	}
+
+	regions = perFrame ? static_cast<uint32_t>(BP->swapChainImages.size()) : 1;
+	BP->createBuffer(stride * capacity * regions, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+						 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+						 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+						 buffer, bufferMemory);
+}
+
+void InstanceBuffer::cleanup() {
+	BP->destroyBuffer(buffer, bufferMemory);
+}
+
+void InstanceBuffer::map(int currentImage, const void *src, uint32_t count, uint32_t first) {
+	if(first + count > capacity) {
+		throw std::runtime_error("too many instances for the instance buffer!");
+	}
+	memcpy(static_cast<char *>(mapped(currentImage)) + stride * first, src, stride * count);
+}
+
+void *InstanceBuffer::mapped(int currentImage) {
+	return static_cast<char *>(bufferMemory.mapped) + offset(currentImage);
+}
+
+VkDeviceSize InstanceBuffer::offset(int currentImage) {
+	return perFrame ? stride * capacity * currentImage : 0;
+}
 
-	vkMapMemory(BP->device, uniformBuffersMemory[slot][currentImage], 0,
-						size, 0, &data);
-	memcpy(data, src, size);
-	vkUnmapMemory(BP->device, uniformBuffersMemory[slot][currentImage]);	
+void InstanceBuffer::bind(VkCommandBuffer commandBuffer, int currentImage) {
+	VkDeviceSize bufferOffset = offset(currentImage);
+	vkCmdBindVertexBuffers(commandBuffer, binding, 1, &buffer, &bufferOffset);
 }
@@ -0,0 +1,72 @@
+// Interleaving of the attribute streams read by the model loaders (positions, normals, UVs, ...) into the
+// vertex layout of a VertexDescriptor. The caller sizes the output once, then every attribute is copied into
+// its offset with a strided loop. The layout of the game, pos uv normal in 32 bytes, has an SSE2 path that
+// builds each vertex in two registers; other targets, or VERTEX_PACKER_SCALAR, use the strided copies.
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#if !defined(VERTEX_PACKER_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define VERTEX_PACKER_SSE2
+#include <emmintrin.h>
+#endif
+
+struct VertexPacker {
+	// Element i (components floats) is read at src + i * srcStride and written at dst + i * dstStride + offset
+	static void scatter(const void *src, size_t srcStride, int components, size_t count,
+						unsigned char *dst, size_t dstStride, uint32_t offset) {
+		switch (components) {
+			case 2: scatterN<2>(src, srcStride, count, dst + offset, dstStride); break;
+			case 3: scatterN<3>(src, srcStride, count, dst + offset, dstStride); break;
+			case 4: scatterN<4>(src, srcStride, count, dst + offset, dstStride); break;
+			default:
+				for (size_t i = 0; i < count; i++) {
+					memcpy(dst + offset + i * dstStride, static_cast<const char *>(src) + i * srcStride, components * sizeof(float));
+				}
+		}
+	}
+
+	// Offsets of the pos uv normal layout, with tightly packed sources of the same count
+	static const uint32_t posUVNormalStride = 32, posOffset = 0, uvOffset = 12, normalOffset = 20;
+
+	static void scatterPosUVNormal(const float *pos, const float *uv, const float *normal, size_t count, unsigned char *dst) {
+		size_t i = 0;
+#ifdef VERTEX_PACKER_SSE2
+		// The unaligned loads of pos and normal read one float past the element: the last vertex is scalar
+		for (; i + 1 < count; i++) {
+			__m128 p = _mm_loadu_ps(pos + 3 * i);									// px py pz -
+			__m128 n = _mm_loadu_ps(normal + 3 * i);								// nx ny nz -
+			__m128 t = _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double *>(uv + 2 * i)));	// u v 0 0
+			__m128 pu = _mm_shuffle_ps(p, t, _MM_SHUFFLE(0, 0, 2, 2));				// pz pz u u
+			__m128 vn = _mm_shuffle_ps(t, n, _MM_SHUFFLE(0, 0, 1, 1));				// v v nx nx
+			float *o = reinterpret_cast<float *>(dst + i * posUVNormalStride);
+			_mm_storeu_ps(o, _mm_shuffle_ps(p, pu, _MM_SHUFFLE(2, 0, 1, 0)));		// px py pz u
+			_mm_storeu_ps(o + 4, _mm_shuffle_ps(vn, n, _MM_SHUFFLE(2, 1, 2, 0)));	// v nx ny nz
+		}
+#endif
+		for (; i < count; i++) {
+			unsigned char *o = dst + i * posUVNormalStride;
+			memcpy(o + posOffset, pos + 3 * i, 3 * sizeof(float));
+			memcpy(o + uvOffset, uv + 2 * i, 2 * sizeof(float));
+			memcpy(o + normalOffset, normal + 3 * i, 3 * sizeof(float));
+		}
+	}
+
+	static const char *path() {
+#ifdef VERTEX_PACKER_SSE2
+		return "SSE2";
+#else
+		return "scalar";
+#endif
+	}
+
+private:
+	template <int N>
+	static void scatterN(const void *src, size_t srcStride, size_t count, unsigned char *dst, size_t dstStride) {
+		const char *s = static_cast<const char *>(src);
+		for (size_t i = 0; i < count; i++) {
+			memcpy(dst + i * dstStride, s + i * srcStride, N * sizeof(float));
+		}
+	}
+};
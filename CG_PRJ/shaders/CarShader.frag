@@ -8,9 +8,11 @@ layout(set = 0, binding = 0) uniform GlobalUniformBufferObject{
 	vec3 lightPos; 
 	vec4 lightColor; 
 	vec3 viewerPosition; 
+	mat4 vpMat; 
+	vec4 lightColorSpot; 
 } gubo; 
 
-layout(set = 1, binding = 1) uniform sampler2D carTexture;
+layout(set = 1, binding = 0) uniform sampler2D carTexture;
 
 layout(location = 0) in vec2 fragTexCoord; // Interpolated texture coordinate
 layout(location = 1) in vec3 fragNormal; 
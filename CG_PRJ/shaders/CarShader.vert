@@ -1,22 +1,29 @@
 #version 450
 
-layout(set = 1, binding = 0) uniform UniformBufferObject {
-	mat4 mvpMat;
-	mat4 mMat;
-	mat4 nMat;
-} ubo;
+layout(set = 0, binding = 0) uniform GlobalUniformBufferObject{
+	vec3 lightPos; 
+	vec4 lightColor; 
+	vec3 viewerPosition; 
+	mat4 vpMat; 
+	vec4 lightColorSpot; 
+} gubo; 
 
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec2 inUV;
 layout(location = 2) in vec3 inNormal; 
 
+// Per instance, from the instance buffer: a mat4 takes four locations
+layout(location = 3) in mat4 inMMat;
+layout(location = 7) in mat4 inNMat;
+
 layout(location = 0) out vec2 fragTexCoord;
 layout(location = 1) out vec3 fragNorm; 
 layout(location = 2) out vec3 fragPos; 
 
 void main() {
-	gl_Position = ubo.mvpMat * vec4(inPosition, 1.0);
-	fragPos = (ubo.mMat * vec4(inPosition, 1.0)).xyz;
+	vec4 worldPos = inMMat * vec4(inPosition, 1.0);
+	gl_Position = gubo.vpMat * worldPos;
+	fragPos = worldPos.xyz;
 	fragTexCoord = inUV;
-	fragNorm = mat3(ubo.nMat) * inNormal;	
-}
\ No newline at end of file
+	fragNorm = mat3(inNMat) * inNormal;	
+}
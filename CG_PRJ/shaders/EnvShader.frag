@@ -8,9 +8,11 @@ layout(set = 0, binding = 0) uniform GlobalUniformBufferObject{
 	vec3 lightDir; 
 	vec4 lightColor; 
 	vec3 viewerPosition; 
+	mat4 vpMat; 
+	vec4 lightColorSpot; 
 } gubo; 
 
-layout(set = 1, binding = 1) uniform sampler2D floorTexture;
+layout(set = 1, binding = 0) uniform sampler2D floorTexture;
 
 layout(location = 0) in vec3 fragPos; 
 layout(location = 1) in vec2 fragTexCoord;
@@ -4,8 +4,7 @@
 const float SHININESS = 150.0;
 const float AMBIENT_INTENSITY = 0.2f;
 const float SPECULAR_INTENSITY = 1.0f;
-const int MAP_SIZE = 11;
-const int NUM_CARS = 3;
+const int MAX_LIT_CARS = 3;	// cars nearest to the camera, chosen by the application
 
 // params for the car lights
 const float G_CAR = 3.0f; 
@@ -23,24 +22,29 @@ layout(set = 0, binding = 0) uniform GlobalUniformBufferObject{
 	vec3 lightPos; 
 	vec4 lightColor; 
 	vec3 viewerPosition; 
+	mat4 vpMat; 
+	vec4 lightColorSpot; 
 } gubo; 
 
 layout(set = 1, binding = 0) uniform sampler2D floorTexture;
 
 layout(set = 1, binding = 2) uniform CarLightsUniformBufferObject {
-    vec3 headlightPosition[NUM_CARS][2];
-    vec3 headlightDirection[NUM_CARS][2];
-    vec4 headlightColor[NUM_CARS][2];
+    vec3 headlightPosition[MAX_LIT_CARS][2];
+    vec3 headlightDirection[MAX_LIT_CARS][2];
+    vec4 headlightColor[MAX_LIT_CARS][2];
 
-	vec3 rearLightPosition[NUM_CARS][2]; 
-	vec3 rearLightDirection[NUM_CARS][2];
-	vec4 rearLightColor[NUM_CARS][2];
+	vec3 rearLightPosition[MAX_LIT_CARS][2]; 
+	vec3 rearLightDirection[MAX_LIT_CARS][2];
+	vec4 rearLightColor[MAX_LIT_CARS][2];
 } cubo;
 
-layout(set = 1, binding = 3) uniform RoadLightsUniformBufferObject{
-	vec4 spotLight_lightPosition[MAP_SIZE * MAP_SIZE][3];
-	vec4 spotLight_spotDirection[MAP_SIZE * MAP_SIZE][3];
-	vec4 lightColorSpot;
+struct RoadSpotLights {
+	vec4 spotLight_lightPosition[3];
+	vec4 spotLight_spotDirection[3];
+};
+
+layout(std430, set = 1, binding = 3) readonly buffer RoadLights {
+	RoadSpotLights lamps[];
 } rlubo; 
 
 layout(location = 0) in vec3 fragPos; 
@@ -89,7 +93,7 @@ void main() {
 	vec3 sunColor = getLightColor_DL_M(gubo.lightColor) * (lambertDiffuse(lightDir_DL, vec3(normal.x, abs(normal.y), normal.z))
 																		+ blinnSpecular(lightDir_DL, vec3(normal.x, abs(normal.y), normal.z), gubo.viewerPosition));
 	// Car lights
-	for (int j = 0; j < NUM_CARS; j++) {
+	for (int j = 0; j < MAX_LIT_CARS; j++) {
 		for (int i = 0; i < 2; i++) {
 			lightDir_SL = getLightDir_SL_M(cubo.headlightPosition[j][i]); 
 			carsColor += getLightColor_SL_M(cubo.headlightColor[j][i], cubo.headlightPosition[j][i], cubo.headlightDirection[j][i], -lightDir_SL, G_CAR, BETA_CAR, HEADLIGHT_INNER_CUTOFF, HEADLIGHT_OUTER_CUTOFF) *
@@ -103,8 +107,8 @@ void main() {
 
 	// Road lights
 	for(int i = 0; i < 3; i++) {
-		lightDir_SL = getLightDir_SL_M(vec3(rlubo.spotLight_lightPosition[current][i])); 
-		lampsColor += getLightColor_SL_M(rlubo.lightColorSpot, vec3(rlubo.spotLight_lightPosition[current][i]), vec3(rlubo.spotLight_spotDirection[current][i]), -lightDir_SL, G_LAMP, BETA_LAMP, LAMP_INNER_CUTOFF, LAMP_OUTER_CUTOFF) *  
+		lightDir_SL = getLightDir_SL_M(vec3(rlubo.lamps[current].spotLight_lightPosition[i])); 
+		lampsColor += getLightColor_SL_M(gubo.lightColorSpot, vec3(rlubo.lamps[current].spotLight_lightPosition[i]), vec3(rlubo.lamps[current].spotLight_spotDirection[i]), -lightDir_SL, G_LAMP, BETA_LAMP, LAMP_INNER_CUTOFF, LAMP_OUTER_CUTOFF) *  
 						lambertDiffuse(lightDir_SL, vec3(normal.x, abs(normal.y), normal.z));  
 	}
 
@@ -1,27 +1,40 @@
 #version 450
 
-const int MAP_SIZE = 11;
+layout(set = 0, binding = 0) uniform GlobalUniformBufferObject{
+	vec3 lightPos; 
+	vec4 lightColor; 
+	vec3 viewerPosition; 
+	mat4 vpMat; 
+	vec4 lightColorSpot; 
+} gubo; 
 
-layout(set = 1, binding = 1) uniform RoadUniformBufferObject {
-	mat4 mvpMat[MAP_SIZE * MAP_SIZE];
-	mat4 mMat[MAP_SIZE * MAP_SIZE];
-	mat4 nMat[MAP_SIZE * MAP_SIZE];
+struct InstanceTransform {
+	mat4 mMat;
+	mat4 nMat;
+};
+
+layout(std430, set = 1, binding = 1) readonly buffer RoadInstances {
+	InstanceTransform instances[];
 } rubo;
 
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec2 inUV;
 layout(location = 2) in vec3 inNormal; 
 
+// Per instance: index of the instance in the road table (the visible ones are compacted by the culling)
+layout(location = 3) in uint inInstance;
+
 layout(location = 0) out vec3 fragPos; 
 layout(location = 1) out vec2 fragTexCoord;
 layout(location = 2) out vec3 fragNorm; 
 layout(location = 3) out flat int current; 
 
 void main() {
-	int i = gl_InstanceIndex ;
-	gl_Position = rubo.mvpMat[i] * vec4(inPosition, 1.0);
-	fragPos = (rubo.mMat[i] * vec4(inPosition, 1.0)).xyz;
+	int i = int(inInstance);
+	vec4 worldPos = rubo.instances[i].mMat * vec4(inPosition, 1.0);
+	gl_Position = gubo.vpMat * worldPos;
+	fragPos = worldPos.xyz;
 	fragTexCoord = inUV;
-	fragNorm = mat3(rubo.nMat[i]) * inNormal;
+	fragNorm = mat3(rubo.instances[i].nMat) * inNormal;
 	current = i; 
 }
\ No newline at end of file
@@ -1,10 +1,31 @@
-#version 450#extension GL_ARB_separate_shader_objects : enable
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
 
 layout(location = 0) in vec3 fragTexCoord;
 
 layout(location = 0) out vec4 outColor;
 
-layout(binding = 1) uniform sampler2D skybox;layout(binding = 2) uniform sampler2D stars;
+layout(binding = 0) uniform UniformBufferObject {
+	mat4 mvpMat;
+	int phase;	// 0: sunrise, 1: day, 2: sunset, 3: night
+} ubo;
 
-void main() {	float yaw = -(atan(fragTexCoord.x, fragTexCoord.z)/6.2831853+0.5);	float pitch = -(atan(fragTexCoord.y, sqrt(fragTexCoord.x*fragTexCoord.x+fragTexCoord.z*fragTexCoord.z))/3.14159265+0.5);	outColor = texture(skybox, vec2(yaw, pitch))*0.9+texture(stars, vec2(yaw, pitch))*0.1;
-}
\ No newline at end of file
+layout(binding = 1) uniform sampler2D skybox[2];	// clouds, starmap
+layout(binding = 2) uniform sampler2D stars[4];		// sunrise, day, sunset, constellations
+
+void main() {
+	float yaw = -(atan(fragTexCoord.x, fragTexCoord.z)/6.2831853+0.5);
+	float pitch = -(atan(fragTexCoord.y, sqrt(fragTexCoord.x*fragTexCoord.x+fragTexCoord.z*fragTexCoord.z))/3.14159265+0.5);
+	vec2 uv = vec2(yaw, pitch);
+
+	// constant indices only, so no dynamic indexing feature is needed
+	vec4 sky = (ubo.phase == 3) ? texture(skybox[1], uv) : texture(skybox[0], uv);
+	vec4 overlay;
+	switch (ubo.phase) {
+	case 0:  overlay = texture(stars[0], uv); break;
+	case 1:  overlay = texture(stars[1], uv); break;
+	case 2:  overlay = texture(stars[2], uv); break;
+	default: overlay = texture(stars[3], uv); break;
+	}
+	outColor = sky*0.9+overlay*0.1;
+}
@@ -2,6 +2,7 @@
 #extension GL_ARB_separate_shader_objects : enable
 layout(binding = 0) uniform UniformBufferObject {
 	mat4 mvpMat;
+	int phase;
 } ubo;
 layout(location = 0) in vec3 inPosition;
 
@@ -104,7 +104,7 @@ class GridApp:
         self.save_button.grid(row=self.rows, column=0, columnspan=self.cols, sticky="e", pady=10, padx=10)
 
     def save_config(self):
-        config = {"_map": [], "checkpoints": [], "start": None, "end": None}
+        config = {"_map": [], "checkpoints": [], "start": None, "end": None, "size": max(self.rows, self.cols)}
         start = None
         config["_map"] = self.selected_items  # Include the selected items
         for item in self.selected_items: